@@ -3,32 +3,72 @@
 #include "esp_sntp.h"
 #include "mqtt_client.h"
 #include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_task_wdt.h"
 #include <sys/param.h>
 #include "cJSON.h"
 #include <map>
+#include <vector>
 #include <functional>
 #include <memory>
 #include <string>
 #include <exception>
+#include <algorithm>
+#include <string.h>
 #include "IIoTClient.h"
 #include "AzureMqttIoTClient.h"
 #include <mbedtls/sha256.h>  // Include this for SHA-256 hash function
 
 static const char *TAG = "AzureMqttIoTClient";
 
+// Tasks created through IIoTClient::CreateTask, tracked by name for the stack high-water mark report.
+// Names are looked up again for each report, so a task that was deleted meanwhile is skipped.
+static const size_t MAX_TRACKED_TASKS = 16;
+static char g_createdTaskNames[MAX_TRACKED_TASKS][configMAX_TASK_NAME_LEN];
+static size_t g_createdTaskCount;
+static portMUX_TYPE g_createdTasksLock = portMUX_INITIALIZER_UNLOCKED;
+
 namespace AzureEventGrid
 {
     /*static*/ MqttIoTClient *MqttIoTClient::_pThis;
     
     /*static*/ IIoTClient* IIoTClient::Initialize(const IoTClientConfig& mqttCfg, IIoTClient::DesiredPropertyCallback_t callback,
-            IIoTClient::CommandCallback_t commandCallback)
+            IIoTClient::CommandCallback_t commandCallback, IIoTClient::DesiredPropertiesCallback_t desiredPropertiesCallback)
     {
         ESP_LOGI(TAG, "Initializing MQTT Client");
-        static MqttIoTClient client(mqttCfg, callback, commandCallback);
+        static MqttIoTClient client(mqttCfg, callback, commandCallback, desiredPropertiesCallback);
         MqttIoTClient::_pThis = &client;
         return &client;
     }
 
+    /*static*/ bool IIoTClient::CreateTask(const IoTTaskConfig& taskConfig, TaskFunction_t taskFunction, const char* name, 
+            void* parameter, TaskHandle_t* pTaskHandle)
+    {
+        TaskHandle_t taskHandle = nullptr;
+        BaseType_t result = xTaskCreatePinnedToCore(taskFunction, name, taskConfig.GetStackSize(), parameter, 
+            taskConfig.GetPriority(), &taskHandle, taskConfig.GetCore());
+        if (result != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to create task %s", name);
+            return false;
+        }
+
+        ESP_LOGI(TAG, "Task %s created: core=%d, priority=%u, stack=%" PRIu32, name, (int)taskConfig.GetCore(), 
+            (unsigned int)taskConfig.GetPriority(), taskConfig.GetStackSize());
+        portENTER_CRITICAL(&g_createdTasksLock);
+        if (g_createdTaskCount < MAX_TRACKED_TASKS)
+        {
+            strlcpy(g_createdTaskNames[g_createdTaskCount++], name, configMAX_TASK_NAME_LEN);
+        }
+        portEXIT_CRITICAL(&g_createdTasksLock);
+        if (pTaskHandle != nullptr)
+        {
+            *pTaskHandle = taskHandle;
+        }
+        return true;
+    }
+
 void log_sha256_hash(const unsigned char* data, size_t data_len, const char* label) {
     unsigned char hash[32];
     char hashString[65];  // 64 chars for the hash, 1 for null-terminator
@@ -43,22 +83,77 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
     ESP_LOGI(TAG, "%s SHA-256: %s", label, hashString);
 }
 
+// Prefer the fingerprint computed at build time, hash the credential only when it is not provided
+static void log_credential_fingerprint(const char* fingerprint, const char* data, size_t data_len, const char* label) {
+    if (fingerprint != nullptr) {
+        ESP_LOGI(TAG, "%s SHA-256: %s", label, fingerprint);
+    } else {
+        log_sha256_hash(reinterpret_cast<const unsigned char*>(data), data_len, label);
+    }
+}
+
 
-    MqttIoTClient::MqttIoTClient(const IoTClientConfig& iotClientConfig, IIoTClient::DesiredPropertyCallback_t desiredPropertyCallback, IIoTClient::CommandCallback_t commandCallback) :
-     _clientId(iotClientConfig.GetClientId()), _commandCallback(commandCallback), _desiredPropertyCallback(desiredPropertyCallback) 
+    MqttIoTClient::MqttIoTClient(const IoTClientConfig& iotClientConfig, IIoTClient::DesiredPropertyCallback_t desiredPropertyCallback, IIoTClient::CommandCallback_t commandCallback,
+        IIoTClient::DesiredPropertiesCallback_t desiredPropertiesCallback) :
+     _clientId(iotClientConfig.GetClientId()), _topics(_clientId), _commandCallback(commandCallback), _desiredPropertyCallback(desiredPropertyCallback),
+     _desiredPropertiesCallback(desiredPropertiesCallback),
+     _taskStatsPeriodMs(iotClientConfig.GetTaskStatsPeriodMs()),
+     _otaUpdater(_otaPartitionWriter, [this](std::string_view progress) { PublishReportedProperty("ota", progress); }),
+     _messageDispatcher(_topics, *this, TWIN_SYNC_TIMEOUT_MS)
     {
-        auto clientPrefix = std::string("device/") + _clientId;
-        _responsesTopic = clientPrefix + std::string("/responses/");
-        _commandsTopic = clientPrefix + std::string("/commands/");
-        _desiredPropertyTopic = clientPrefix + std::string("/twin/desired/");
-        _reportedPropertyTopic = clientPrefix + std::string("/twin/reported/");
-        _telemetryTopic = clientPrefix + std::string("/telemetry/");
+        const int64_t initStartTime = esp_timer_get_time();
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+        _startupBenchmark.Begin(StartupBenchmark::Phase::Init);
+#endif
+        _reportedPropertiesLock = xSemaphoreCreateMutex();
+        _taskStatsLock = xSemaphoreCreateMutex();
+
+        // Create the pool before any message buffer is needed
+        MessageBufferPool::GetInstance();
+
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+        _stallDetector.Begin();
+#endif
 
-        _messageHandlers[0] = std::make_unique<CommandHandler>(this);
-        _messageHandlers[1] = std::make_unique<DesiredPropertyHandler>(this);
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        _payloadEncoderLock = xSemaphoreCreateMutex();
+#endif
+
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        // Restore the twin from the previous cycle, so the application gets its configuration before connecting
+        _dutyCycleState.BeginCycle();
+        PoolPropertyMap restoredProperties;
+        _dutyCycleState.RestoreProperties(restoredProperties, _reportedProperties);
+        DesiredPropertyList_t restoredPropertyList;
+        for (const auto& [propertyName, propertyValue] : restoredProperties)
+        {
+            restoredPropertyList.push_back(_messageDispatcher.StoreDesiredProperty(propertyName, propertyValue));
+        }
+        _messageDispatcher.NotifyDesiredProperties(restoredPropertyList);
+#endif
 
         ESP_LOGI(TAG, "this=%x\n", (unsigned int)this);
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        // The system time is kept by the RTC during deep sleep
+        if (_dutyCycleState.GetCycleCount() == 1)
+        {
+            obtain_time();
+        }
+#else
         obtain_time();
+#endif
+
+        _dispatchQueue = xQueueCreate(CONFIG_IOT_CLIENT_DISPATCH_QUEUE_LENGTH, sizeof(InboundMessage*));
+        if (_dispatchQueue == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to create the dispatch queue");
+            return;
+        }
+
+        if (!CreateTask(iotClientConfig.GetDispatchTaskConfig(), MqttIoTClient::DispatchTask, "IoTDispatch", this, &_dispatchTaskHandle))
+        {
+            return;
+        }
         
         ESP_LOGI(TAG, "Initializing MQTT client for device %s", _clientId.c_str());
         esp_mqtt_client_config_t mqttCfg = {};
@@ -68,17 +163,15 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
         mqttCfg.credentials.client_id = iotClientConfig.GetClientId();
         ESP_LOGI(TAG, "Client ID: %s", mqttCfg.credentials.client_id);
 
-         // Log client certificate hash
-        const unsigned char* client_cert = (const unsigned char*)iotClientConfig.GetClientCert();
-        const size_t client_cert_len = iotClientConfig.GetClientCertLength();
-        log_sha256_hash(client_cert, client_cert_len, "Client Certificate");
+        // Log client certificate hash, the certificate and key can be PEM or DER (cheaper to parse on each connection)
+        log_credential_fingerprint(iotClientConfig.GetClientCertFingerprint(), iotClientConfig.GetClientCert(), 
+            iotClientConfig.GetClientCertLength(), "Client Certificate");
         mqttCfg.credentials.authentication.certificate = iotClientConfig.GetClientCert();
         mqttCfg.credentials.authentication.certificate_len = iotClientConfig.GetClientCertLength();
 
         // Log client key hash
-        const unsigned char* client_key = (const unsigned char*)iotClientConfig.GetClientKey();
-        const size_t client_key_len = iotClientConfig.GetClientKeyLength();
-        log_sha256_hash(client_key, client_key_len, "Client Key");
+        log_credential_fingerprint(iotClientConfig.GetClientKeyFingerprint(), iotClientConfig.GetClientKey(), 
+            iotClientConfig.GetClientKeyLength(), "Client Key");
         mqttCfg.credentials.authentication.key = iotClientConfig.GetClientKey();
         mqttCfg.credentials.authentication.key_len = iotClientConfig.GetClientKeyLength();
 
@@ -87,11 +180,44 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
         ESP_LOGI(TAG, "Username: %s", mqttCfg.credentials.username);
 
         // Log broker certificate hash
-        const unsigned char* broker_cert = (const unsigned char*)iotClientConfig.GetBrokerCert();
-        const size_t broker_cert_len = iotClientConfig.GetBrokerCertLength();
-        log_sha256_hash(broker_cert, broker_cert_len, "Broker Certificate");
+        log_credential_fingerprint(iotClientConfig.GetBrokerCertFingerprint(), iotClientConfig.GetBrokerCert(), 
+            iotClientConfig.GetBrokerCertLength(), "Broker Certificate");
+
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK_BASELINE
+        // The baseline parses the broker certificate chain on each connection
         mqttCfg.broker.verification.certificate = iotClientConfig.GetBrokerCert();
         mqttCfg.broker.verification.certificate_len = iotClientConfig.GetBrokerCertLength();
+#else
+        // Parse the broker certificate chain once, the global CA store keeps it for all the reconnections
+        esp_err_t caStoreResult = esp_tls_set_global_ca_store(reinterpret_cast<const unsigned char*>(iotClientConfig.GetBrokerCert()), 
+            iotClientConfig.GetBrokerCertLength());
+        if (caStoreResult == ESP_OK)
+        {
+            mqttCfg.broker.verification.use_global_ca_store = true;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Failed to set the global CA store (%s), the broker certificate is parsed on each connection", 
+                esp_err_to_name(caStoreResult));
+            mqttCfg.broker.verification.certificate = iotClientConfig.GetBrokerCert();
+            mqttCfg.broker.verification.certificate_len = iotClientConfig.GetBrokerCertLength();
+        }
+#endif
+
+        const IoTTaskConfig& networkTaskConfig = iotClientConfig.GetNetworkTaskConfig();
+        mqttCfg.task.priority = networkTaskConfig.GetPriority();
+        mqttCfg.task.stack_size = networkTaskConfig.GetStackSize();
+
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        // Compressed payloads fit a smaller buffer, larger inbound messages arrive in fragments
+        mqttCfg.buffer.size = CONFIG_IOT_CLIENT_COMPRESSION_MQTT_BUFFER_SIZE;
+        mqttCfg.buffer.out_size = CONFIG_IOT_CLIENT_COMPRESSION_MQTT_BUFFER_SIZE;
+#endif
+
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        // Keep the broker session between cycles, so the subscriptions and the QoS 1 messages sent while sleeping are kept
+        mqttCfg.session.disable_clean_session = true;
+#endif
 
         _client = esp_mqtt_client_init(&mqttCfg);
 
@@ -110,6 +236,60 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
             return;
         }
         ESP_LOGI(TAG, "MQTT client registered to MQTT event handler");
+
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        esp_timer_create_args_t heartbeatTimerArgs = {};
+        heartbeatTimerArgs.callback = [](void* pArg)
+        {
+            auto pClient = static_cast<MqttIoTClient*>(pArg);
+            if (pClient->_isNetworkTaskWatched)
+            {
+                esp_mqtt_event_t heartbeatEvent = {};
+                heartbeatEvent.event_id = MQTT_USER_EVENT;
+                esp_mqtt_dispatch_custom_event(pClient->_client, &heartbeatEvent);
+            }
+        };
+        heartbeatTimerArgs.arg = this;
+        heartbeatTimerArgs.name = "iot_wdt_heartbeat";
+        if (esp_timer_create(&heartbeatTimerArgs, &_watchdogHeartbeatTimer) != ESP_OK || 
+            esp_timer_start_periodic(_watchdogHeartbeatTimer, WATCHDOG_HEARTBEAT_PERIOD_MS * 1000) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to start the watchdog heartbeat timer");
+        }
+#endif
+
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        // Wakes the dispatch task up when the twin document is late
+        esp_timer_create_args_t twinSyncTimerArgs = {};
+        twinSyncTimerArgs.callback = [](void* pArg)
+        {
+            auto pClient = static_cast<MqttIoTClient*>(pArg);
+            InboundMessage* pWakeUp = nullptr;
+            xQueueSend(pClient->_dispatchQueue, &pWakeUp, 0);
+        };
+        twinSyncTimerArgs.arg = this;
+        twinSyncTimerArgs.name = "iot_twin_sync";
+        if (esp_timer_create(&twinSyncTimerArgs, &_twinSyncTimer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create the twin synchronization timer");
+        }
+#endif
+
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+        esp_timer_create_args_t benchmarkDisconnectTimerArgs = {};
+        benchmarkDisconnectTimerArgs.callback = [](void* pArg)
+        {
+            esp_mqtt_client_disconnect(static_cast<MqttIoTClient*>(pArg)->_client);
+        };
+        benchmarkDisconnectTimerArgs.arg = this;
+        benchmarkDisconnectTimerArgs.name = "iot_benchmark";
+        if (esp_timer_create(&benchmarkDisconnectTimerArgs, &_benchmarkDisconnectTimer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create the startup benchmark timer");
+        }
+        // The connection phases run on the network task once the client is started
+        _startupBenchmark.End(StartupBenchmark::Phase::Init);
+#endif
         
         result = esp_mqtt_client_start(_client);
         if (result != ESP_OK)
@@ -118,116 +298,446 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
             return;
         }
 
+         ESP_LOGI(TAG, "MQTT client initialized in %" PRIi64 " ms", (esp_timer_get_time() - initStartTime) / 1000);
          ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
     }
 
     MqttIoTClient::~MqttIoTClient() 
     {
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        if (_watchdogHeartbeatTimer != nullptr)
+        {
+            esp_timer_stop(_watchdogHeartbeatTimer);
+            esp_timer_delete(_watchdogHeartbeatTimer);
+        }
+#endif
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        if (_twinSyncTimer != nullptr)
+        {
+            esp_timer_stop(_twinSyncTimer);
+            esp_timer_delete(_twinSyncTimer);
+        }
+#endif
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+        if (_benchmarkDisconnectTimer != nullptr)
+        {
+            esp_timer_stop(_benchmarkDisconnectTimer);
+            esp_timer_delete(_benchmarkDisconnectTimer);
+        }
+#endif
+
         if (_client != nullptr) 
         {
             esp_mqtt_client_stop(_client);
             esp_mqtt_client_destroy(_client);
         }
+
+        if (_dispatchTaskHandle != nullptr)
+        {
+            vTaskDelete(_dispatchTaskHandle);
+        }
+
+        if (_dispatchQueue != nullptr)
+        {
+            InboundMessage* pMessage = nullptr;
+            while (xQueueReceive(_dispatchQueue, &pMessage, 0) == pdTRUE)
+            {
+                MessageBufferPool::GetInstance().Delete(pMessage);
+            }
+            vQueueDelete(_dispatchQueue);
+        }
     }
 
     void MqttIoTClient::SendTelemetry(const std::string& telemetrySubTopicName, const std::string& telemetryData) 
+    {
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        // Telemetry is sent in one burst when the connection is up, see RunDutyCycle
+        if (IsConnected() == false)
+        {
+            ESP_LOGI(TAG, "Queuing telemetry of sub topic: %s, data: %s", telemetrySubTopicName.c_str(), telemetryData.c_str());
+            _dutyCycleState.QueueTelemetry(telemetrySubTopicName, telemetryData);
+            return;
+        }
+#endif
+        PublishTelemetry(telemetrySubTopicName, telemetryData);
+    }
+
+    /*static*/ PoolString MqttIoTClient::MakeTopic(const std::string& topicPrefix, std::string_view subTopic)
+    {
+        PoolString topic;
+        topic.reserve(topicPrefix.length() + subTopic.length());
+        topic.append(topicPrefix).append(subTopic);
+        return topic;
+    }
+
+    int MqttIoTClient::Publish(const PoolString& topic, std::string_view payload)
+    {
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        // esp-mqtt holds its API lock for a whole reconnection, TLS handshake included, and esp_mqtt_client_enqueue takes
+        // the same lock. The dispatch task leaves the watchdog while it waits, the publish budget still traces the wait.
+        const bool isUnwatched = _isDispatchTaskWatched && xTaskGetCurrentTaskHandle() == _dispatchTaskHandle && 
+            esp_task_wdt_delete(nullptr) == ESP_OK;
+#endif
+        int msg_id = esp_mqtt_client_publish(_client, topic.c_str(), payload.data(), payload.length(), MQTT_QOS, 0);
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        if (isUnwatched && esp_task_wdt_add(nullptr) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to subscribe the dispatch task to the watchdog again");
+            _isDispatchTaskWatched = false;
+        }
+#endif
+        return msg_id;
+    }
+
+    int MqttIoTClient::PublishTelemetry(std::string_view telemetrySubTopicName, std::string_view telemetryData) 
     {
         //first check if the client is connected
         if (IsConnected() == false) 
         {
             ESP_LOGE(TAG, "MQTT client is not connected");
-            return;
+            return -1;
         }
 
-        ESP_LOGI(TAG, "Sending telemetry of sub topic: %s, data: %s", telemetrySubTopicName.c_str(), telemetryData.c_str());
-        auto topic = _telemetryTopic + telemetrySubTopicName;
+        ESP_LOGI(TAG, "Sending telemetry of sub topic: %.*s, data: %.*s", (int)telemetrySubTopicName.length(), telemetrySubTopicName.data(), 
+            (int)telemetryData.length(), telemetryData.data());
+        auto topic = MakeTopic(_topics.GetTelemetryTopic(), telemetrySubTopicName);
+        PoolString encodedBuffer;
+        auto payload = EncodePayload(telemetryData, encodedBuffer);
 
-        int msg_id = esp_mqtt_client_publish(_client, topic.c_str(), telemetryData.c_str(), telemetryData.length(), MQTT_QOS, 0);
+        const int64_t publishStartTime = esp_timer_get_time();
+        int msg_id = Publish(topic, payload);
+        TraceStage(StallDetector::Stage::Publish, publishStartTime, msg_id);
         if (msg_id == -1)
         {
             ESP_LOGE(TAG, "Failed to send telemetry data");
         }
+        return msg_id;
     }
 
     bool MqttIoTClient::UpdateReportedProperties(const std::string& reportedPropertyName, const std::string& reportedPropertyValue) 
     {
-        auto topic = _reportedPropertyTopic + reportedPropertyName;
-        int msg_id = esp_mqtt_client_publish(_client, topic.c_str() , reportedPropertyValue.c_str(), reportedPropertyValue.length(), MQTT_QOS, 0);
+        return PublishReportedProperty(reportedPropertyName, reportedPropertyValue);
+    }
+
+    bool MqttIoTClient::PublishReportedProperty(std::string_view reportedPropertyName, std::string_view reportedPropertyValue) 
+    {
+        auto topic = MakeTopic(_topics.GetReportedPropertyTopic(), reportedPropertyName);
+        PoolString encodedBuffer;
+        auto payload = EncodePayload(reportedPropertyValue, encodedBuffer);
+        const int64_t publishStartTime = esp_timer_get_time();
+        int msg_id = Publish(topic, payload);
+        TraceStage(StallDetector::Stage::Publish, publishStartTime, msg_id);
         if (msg_id == -1)
         {
             ESP_LOGE(TAG, "Failed to send reported properties");
             return false;
         }
-        _reportedProperties[reportedPropertyName] = reportedPropertyValue; // Store locally if needed
+        xSemaphoreTake(_reportedPropertiesLock, portMAX_DELAY);
+        _reportedProperties[PoolString(reportedPropertyName)] = reportedPropertyValue; // Store locally if needed
+        xSemaphoreGive(_reportedPropertiesLock);
         return true;
     }
 
+    std::string_view MqttIoTClient::EncodePayload(std::string_view payload, PoolString& buffer)
+    {
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        if (!_isCompressionAccepted || payload.length() < CONFIG_IOT_CLIENT_COMPRESSION_MIN_SIZE || _payloadEncoderLock == nullptr)
+        {
+            return payload;
+        }
+
+        xSemaphoreTake(_payloadEncoderLock, portMAX_DELAY);
+        const int64_t startTime = esp_timer_get_time();
+        bool isCompressed = _payloadEncoder.Compress(payload, buffer);
+        _compressionStats.timeUs += esp_timer_get_time() - startTime;
+        ++_compressionStats.messageCount;
+        _compressionStats.compressedCount += isCompressed ? 1 : 0;
+        _compressionStats.inputBytes += payload.length();
+        _compressionStats.outputBytes += isCompressed ? buffer.length() : payload.length();
+        xSemaphoreGive(_payloadEncoderLock);
+
+        // Incompressible payloads are sent as they are
+        return isCompressed ? std::string_view(buffer) : payload;
+#else
+        return payload;
+#endif
+    }
+
+    void MqttIoTClient::LogCompressionStats() const
+    {
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        const CompressionStats stats = _compressionStats;
+        if (stats.messageCount == 0)
+        {
+            return;
+        }
+        ESP_LOGI(TAG, "Compression: %" PRIu32 "/%" PRIu32 " payloads compressed, %" PRIu64 " -> %" PRIu64 " bytes (%.1f%%), %" PRIi64 " us per KB", 
+            stats.compressedCount, stats.messageCount, stats.inputBytes, stats.outputBytes, 100.0 * stats.outputBytes / stats.inputBytes,
+            stats.timeUs * 1024 / static_cast<int64_t>(stats.inputBytes));
+#endif
+    }
+
+    void MqttIoTClient::TraceStage(StallDetector::Stage stage, int64_t startTimeUs, int detail)
+    {
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+        // The stage may have run in any task, the dispatch task publishes the report
+        InboundMessage* pWakeUp = nullptr;
+        if (_stallDetector.Record(stage, startTimeUs, detail) && _dispatchQueue != nullptr)
+        {
+            xQueueSend(_dispatchQueue, &pWakeUp, 0);
+        }
+#endif
+    }
+
+    void MqttIoTClient::PublishStallReport()
+    {
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+        // The report is kept until the next connection
+        if (!IsConnected())
+        {
+            return;
+        }
+
+        PoolString report;
+        if (!_stallDetector.TakeReport(report))
+        {
+            return;
+        }
+
+        // Not traced, a slow publish would otherwise report itself
+        auto topic = MakeTopic(_topics.GetDiagnosticsTopic(), "stall");
+        ESP_LOGW(TAG, "Publishing stall report: %s", report.c_str());
+        if (Publish(topic, report) == -1)
+        {
+            ESP_LOGE(TAG, "Failed to publish the stall report");
+        }
+#endif
+    }
+
     /*static*/ void MqttIoTClient::MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data) 
     {
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        // The heartbeat only proves that the network task is alive, keep it out of the log
+        if (event_id == MQTT_USER_EVENT)
+        {
+            if (_pThis->_isNetworkTaskWatched)
+            {
+                esp_task_wdt_reset();
+            }
+            return;
+        }
+#endif
         ESP_LOGI(TAG, "MqttEventHandler");
         _pThis->EventHandler(handler_args, base, event_id, event_data);
     }
 
     std::string MqttIoTClient::GetDesiredProperty(const std::string& propertyName)
     {
-        auto it = _desiredProperties.find(propertyName);
-        if (it != _desiredProperties.end()) 
+        const PoolPropertyMap& desiredProperties = _messageDispatcher.GetDesiredProperties();
+        auto it = desiredProperties.find(PoolString(propertyName));
+        if (it != desiredProperties.end()) 
         {
-            return it->second;
+            return std::string(it->second);
         }
         return "";
     }
 
     std::string MqttIoTClient::GetReportedProperty(const std::string& propertyName)
     {
-        auto it = _reportedProperties.find(propertyName);
+        std::string propertyValue;
+        xSemaphoreTake(_reportedPropertiesLock, portMAX_DELAY);
+        auto it = _reportedProperties.find(PoolString(propertyName));
         if (it != _reportedProperties.end()) 
         {
-            return it->second;
+            propertyValue = it->second;
         }
-        return "";
+        xSemaphoreGive(_reportedPropertiesLock);
+        return propertyValue;
+    }
+
+    bool MqttIoTClient::HasReportedProperty(std::string_view reportedPropertyName)
+    {
+        xSemaphoreTake(_reportedPropertiesLock, portMAX_DELAY);
+        bool isReported = _reportedProperties.find(PoolString(reportedPropertyName)) != _reportedProperties.end();
+        xSemaphoreGive(_reportedPropertiesLock);
+        return isReported;
     }
 
     void MqttIoTClient::EventHandler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data) 
     {
         ESP_LOGI(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32, base, event_id);
+        if (_networkTaskHandle == nullptr)
+        {
+            _networkTaskHandle = xTaskGetCurrentTaskHandle();
+        }
         esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(event_data);
 
         esp_mqtt_client_handle_t client = event->client;
         int msg_id;
         switch ((esp_mqtt_event_id_t)event_id) 
         {
+            case MQTT_EVENT_BEFORE_CONNECT:
+                _connectStartTime = esp_timer_get_time();
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+                _startupBenchmark.Begin(_startupBenchmark.HasConnected() ? StartupBenchmark::Phase::Reconnect : StartupBenchmark::Phase::Connect);
+#endif
+                break;
+
             case MQTT_EVENT_CONNECTED:
             {
                 _isConnected = true;
-                ESP_LOGI(TAG, "_desiredPropertyTopic empty: %d", _desiredPropertyTopic.empty() == false);
-                ESP_LOGI(TAG, "Topic: %s\n", _desiredPropertyTopic.c_str());
+                // Connection time includes the TLS handshake, the minimum free heap shows its peak memory use
+                ESP_LOGI(TAG, "Connected in %" PRIi64 " ms, %" PRIi64 " ms since boot, minimum free heap: %" PRIu32 " bytes", 
+                    (esp_timer_get_time() - _connectStartTime) / 1000, esp_timer_get_time() / 1000, esp_get_minimum_free_heap_size());
+                _pendingSubscriptions = 0;
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+                _startupBenchmark.End(StartupBenchmark::Phase::Connect);
+                _startupBenchmark.End(StartupBenchmark::Phase::Reconnect);
+#endif
+
+                // The image managed to connect to the broker, no need to roll back after an OTA update
+                if (!_isRunningImageValidated)
+                {
+                    OtaPartitionWriter::MarkRunningImageValid();
+                    _isRunningImageValidated = true;
+                }
+
+                // Let the sender resume an interrupted update from the last written offset
+                if (_otaUpdater.IsInProgress())
+                {
+                    _otaUpdater.ReportProgress();
+                }
+
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+                // Only while connected, the TLS handshake of a reconnection may legitimately take longer than the watchdog timeout
+                if (!_isNetworkTaskWatched && esp_task_wdt_add(nullptr) == ESP_OK)
+                {
+                    _isNetworkTaskWatched = true;
+                }
+#endif
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+                // A report of a stall or of a watchdog reset of the previous boot waited for the connection
+                if (_stallDetector.HasPendingReport())
+                {
+                    InboundMessage* pWakeUp = nullptr;
+                    xQueueSend(_dispatchQueue, &pWakeUp, 0);
+                }
+#endif
+
+#if CONFIG_IOT_CLIENT_COMPRESSION
+                // Tell the cloud that compressed desired properties are understood, it opts in with the contentEncoding desired property
+                if (!HasReportedProperty("contentEncoding"))
+                {
+                    PublishReportedProperty("contentEncoding", "lzss");
+                }
+#endif
+
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+                // The desired properties may have changed while disconnected, a request of the previous connection is dropped
+                PostTwinSyncSteps(TWIN_SYNC_BEGIN, true);
+                if (_twinSyncTimer != nullptr)
+                {
+                    esp_timer_stop(_twinSyncTimer);
+                    esp_timer_start_once(_twinSyncTimer, static_cast<uint64_t>(CONFIG_IOT_CLIENT_TWIN_SYNC_TIMEOUT_MS) * 1000);
+                }
+#endif
+
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+                if (event->session_present)
+                {
+                    ESP_LOGI(TAG, "Broker session is present, subscriptions are kept");
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+                    PostTwinSyncSteps(TWIN_SYNC_REQUEST, false);
+#endif
+                    break;
+                }
+#endif
+                ESP_LOGI(TAG, "_desiredPropertyTopic empty: %d", _topics.GetDesiredPropertyTopic().empty() == false);
+                ESP_LOGI(TAG, "Topic: %s\n", _topics.GetDesiredPropertyTopic().c_str());
                 
                 ESP_LOGI(TAG, "Subscribing to topics");
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+                _startupBenchmark.Begin(StartupBenchmark::Phase::Subscribe);
+#endif
 
-                auto desiredPropertyTopic = _desiredPropertyTopic + "#";
+                auto desiredPropertyTopic = _topics.GetDesiredPropertyTopic() + "#";
                 msg_id = esp_mqtt_client_subscribe(client, desiredPropertyTopic.c_str(), MQTT_QOS);
+                _pendingSubscriptions += msg_id != -1 ? 1 : 0;
                 ESP_LOGI(TAG, "sent subscribe %s, msg_id=%d", desiredPropertyTopic.c_str(), msg_id);
 
-                auto commandsTopic = _commandsTopic + "#";
+                auto commandsTopic = _topics.GetCommandsTopic() + "#";
                 msg_id = esp_mqtt_client_subscribe(client, commandsTopic.c_str(), MQTT_QOS);
+                _pendingSubscriptions += msg_id != -1 ? 1 : 0;
                 ESP_LOGI(TAG, "sent subscribe %s, msg_id=%d", commandsTopic.c_str(), msg_id);
 
-                auto responsesTopic = _responsesTopic + "#";
+                auto responsesTopic = _topics.GetResponsesTopic() + "#";
                 msg_id = esp_mqtt_client_subscribe(client, responsesTopic.c_str(), MQTT_QOS);
+                _pendingSubscriptions += msg_id != -1 ? 1 : 0;
                 ESP_LOGI(TAG, "sent subscribe %s, msg_id=%d", responsesTopic.c_str(), msg_id);
 
+                auto otaTopic = _topics.GetOtaTopic() + "#";
+                msg_id = esp_mqtt_client_subscribe(client, otaTopic.c_str(), MQTT_QOS);
+                _pendingSubscriptions += msg_id != -1 ? 1 : 0;
+                ESP_LOGI(TAG, "sent subscribe %s, msg_id=%d", otaTopic.c_str(), msg_id);
+
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+                auto twinDocumentTopic = _topics.GetTwinDocumentTopic() + "#";
+                msg_id = esp_mqtt_client_subscribe(client, twinDocumentTopic.c_str(), MQTT_QOS);
+                _pendingSubscriptions += msg_id != -1 ? 1 : 0;
+                ESP_LOGI(TAG, "sent subscribe %s, msg_id=%d", twinDocumentTopic.c_str(), msg_id);
+
+                // Otherwise requested once all the subscriptions are acknowledged, so the document cannot be missed
+                if (_pendingSubscriptions == 0)
+                {
+                    PostTwinSyncSteps(TWIN_SYNC_REQUEST, false);
+                }
+#endif
+
                 ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
             }
             break;
 
             case MQTT_EVENT_DISCONNECTED:
                 _isConnected = false;
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+                if (_isNetworkTaskWatched && esp_task_wdt_delete(nullptr) == ESP_OK)
+                {
+                    _isNetworkTaskWatched = false;
+                }
+#endif
                 ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+                // Reconnect at once instead of after the reconnect timeout, a failed attempt still waits for it
+                if (_startupBenchmark.HasConnected() && !_startupBenchmark.IsComplete() && 
+                    !_startupBenchmark.IsRunning(StartupBenchmark::Phase::Reconnect))
+                {
+                    esp_mqtt_client_reconnect(client);
+                }
+#endif
                 break;
 
             case MQTT_EVENT_SUBSCRIBED:
                 ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+                if (_pendingSubscriptions > 0)
+                {
+                    --_pendingSubscriptions;
+                }
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+                if (_pendingSubscriptions == 0 && _startupBenchmark.IsRunning(StartupBenchmark::Phase::Subscribe))
+                {
+                    _startupBenchmark.End(StartupBenchmark::Phase::Subscribe);
+                    if (!_startupBenchmark.IsComplete() && _benchmarkDisconnectTimer != nullptr)
+                    {
+                        esp_timer_start_once(_benchmarkDisconnectTimer, static_cast<uint64_t>(BENCHMARK_SETTLE_TIME_MS) * 1000);
+                    }
+                }
+#endif
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+                if (_pendingSubscriptions == 0)
+                {
+                    PostTwinSyncSteps(TWIN_SYNC_REQUEST, false);
+                }
+#endif
                 break;
 
             case MQTT_EVENT_UNSUBSCRIBED:
@@ -236,6 +746,9 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
 
             case MQTT_EVENT_PUBLISHED:
                 ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+                _dutyCycleState.AcknowledgeTelemetry(event->msg_id);
+#endif
                 break;
 
             case MQTT_EVENT_DATA:
@@ -270,79 +783,289 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
     void MqttIoTClient::ProcessMqttEventData(esp_mqtt_client_handle_t client, esp_mqtt_event_handle_t event) 
     {
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
+        const int64_t receiveStartTime = esp_timer_get_time();
+        if (event->current_data_offset == 0)
+        {
+            _fragmentTopic.assign(event->topic, event->topic_len);
+            _fragmentPayload.clear();
+        }
+
+        // OTA chunks are streamed to flash as they arrive, in order, without buffering the image
+        if (_fragmentTopic.compare(0, _topics.GetOtaTopic().length(), _topics.GetOtaTopic()) == 0)
+        {
+            _otaUpdater.HandleMessage(std::string_view(_fragmentTopic).substr(_topics.GetOtaTopic().length()), event->data, event->data_len, 
+                event->current_data_offset, event->total_data_len);
+            TraceStage(StallDetector::Stage::OtaWrite, receiveStartTime, event->msg_id);
+            return;
+        }
+
+        printf("TOPIC=%s\r\n", _fragmentTopic.c_str());
         printf("DATA=%.*s\r\n", event->data_len, event->data);
 
-        std::string topic(event->topic, event->topic_len);
-        std::string payload(event->data, event->data_len);
+        _fragmentPayload.append(event->data, event->data_len);
+        if (event->current_data_offset + event->data_len < event->total_data_len)
+        {
+            return; // wait for the rest of the message
+        }
+
+        auto pMessage = MessageBufferPool::GetInstance().New<InboundMessage>(InboundMessage{_fragmentTopic, std::move(_fragmentPayload), 
+            static_cast<uint16_t>(event->msg_id), event->dup, event->retain, esp_timer_get_time()});
+        _fragmentPayload.clear();
 
-        for (auto& handler : _messageHandlers) 
+        // Do not block the network task for long, the dispatch task may itself wait for the MQTT client lock
+        if (xQueueSend(_dispatchQueue, &pMessage, pdMS_TO_TICKS(1000)) != pdTRUE)
         {
-            if (handler->IsResponsibleFor(topic)) 
+            ESP_LOGE(TAG, "Dispatch queue is full, dropping message of topic %s", pMessage->topic.c_str());
+            MessageBufferPool::GetInstance().Delete(pMessage);
+        }
+        TraceStage(StallDetector::Stage::Receive, receiveStartTime, event->msg_id);
+    }
+
+    /*static*/ void MqttIoTClient::DispatchTask(void* pvParameters)
+    {
+        auto pClient = static_cast<MqttIoTClient*>(pvParameters);
+        const TickType_t statsPeriod = pClient->_taskStatsPeriodMs > 0 ? pdMS_TO_TICKS(pClient->_taskStatsPeriodMs) : portMAX_DELAY;
+        TickType_t lastStatsTime = xTaskGetTickCount();
+        TickType_t receiveTimeout = statsPeriod;
+
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        // A handler or application callback that blocks the dispatch task trips the watchdog
+        pClient->_isDispatchTaskWatched = esp_task_wdt_add(nullptr) == ESP_OK;
+        if (pClient->_isDispatchTaskWatched)
+        {
+            receiveTimeout = MIN(statsPeriod, pdMS_TO_TICKS(WATCHDOG_HEARTBEAT_PERIOD_MS));
+        }
+#endif
+
+        while (1)
+        {
+            // A null message only wakes the task up, e.g. to publish a stall report
+            InboundMessage* pMessage = nullptr;
+            const bool isReceived = xQueueReceive(pClient->_dispatchQueue, &pMessage, receiveTimeout) == pdTRUE;
+
+            // Before the message, which may be a retained property of the connection that posted the steps
+            pClient->RunTwinSyncSteps();
+
+            if (isReceived && pMessage != nullptr)
             {
-                handler->HandleMessage(topic, payload);
-                break;
+                pClient->TraceStage(StallDetector::Stage::QueueWait, pMessage->queuedTimeUs, pMessage->packetId);
+                const int64_t dispatchStartTime = esp_timer_get_time();
+                pClient->_isDispatching = true;
+                pClient->DispatchMessage(*pMessage);
+                pClient->_isDispatching = false;
+                pClient->TraceStage(StallDetector::Stage::Dispatch, dispatchStartTime, pMessage->packetId);
+                MessageBufferPool::GetInstance().Delete(pMessage);
             }
+
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+            if (pClient->_isDispatchTaskWatched)
+            {
+                esp_task_wdt_reset();
+            }
+#endif
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+            if (pClient->_stallDetector.HasPendingReport())
+            {
+                pClient->PublishStallReport();
+            }
+#endif
+            pClient->_messageDispatcher.CheckTwinSyncTimeout();
+
+            if (statsPeriod != portMAX_DELAY && xTaskGetTickCount() - lastStatsTime >= statsPeriod)
+            {
+                lastStatsTime = xTaskGetTickCount();
+                pClient->LogTaskStats();
+                pClient->LogBufferPoolStats();
+                pClient->LogCompressionStats();
+            }
+        }
+    }
+
+    void MqttIoTClient::PostTwinSyncSteps(uint32_t steps, bool isNewConnection)
+    {
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        portENTER_CRITICAL(&_twinSyncLock);
+        _pendingTwinSyncSteps = isNewConnection ? steps : _pendingTwinSyncSteps | steps;
+        portEXIT_CRITICAL(&_twinSyncLock);
+
+        // When the queue is full, the steps run before the next queued message
+        InboundMessage* pWakeUp = nullptr;
+        xQueueSend(_dispatchQueue, &pWakeUp, 0);
+#endif
+    }
+
+    void MqttIoTClient::RunTwinSyncSteps()
+    {
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        const uint32_t steps = _pendingTwinSyncSteps;
+        if (steps == 0)
+        {
+            return;
+        }
+
+        if (steps & TWIN_SYNC_BEGIN)
+        {
+            _messageDispatcher.BeginTwinSync();
+        }
+        if ((steps & TWIN_SYNC_REQUEST) && _messageDispatcher.IsTwinSyncPending())
+        {
+            _messageDispatcher.RequestTwinDocument();
         }
+
+        // Cleared once run, so the sync never looks complete to IsTwinSyncOutstanding in between
+        portENTER_CRITICAL(&_twinSyncLock);
+        _pendingTwinSyncSteps &= ~steps;
+        portEXIT_CRITICAL(&_twinSyncLock);
+#endif
     }
 
+    bool MqttIoTClient::IsTwinSyncOutstanding() const
+    {
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        return _pendingTwinSyncSteps != 0 || _messageDispatcher.IsTwinSyncOutstanding();
+#else
+        return false;
+#endif
+    }
 
-    void MqttIoTClient::CommandHandler::HandleMessage(const std::string& topic, const std::string& payload)
+    void MqttIoTClient::DispatchMessage(const InboundMessage& message)
     {
-        ESP_LOGI(TAG, "Received command: %s with payload: %s", topic.c_str(), payload.c_str());
+        _messageDispatcher.Dispatch({message.topic, message.payload, message.packetId, message.isRedelivery, message.isRetained});
+    }
 
-        //the command name is the last part of the topic
-        auto pos = topic.find_last_of('/');
-        if (pos == std::string::npos)
+    void MqttIoTClient::LogBufferPoolStats()
+    {
+        MessageBufferPool::GetInstance().LogStats();
+    }
+
+    void MqttIoTClient::LogTaskStats()
+    {
+        // Called from the application and the dispatch task, the run times of the previous report are shared
+        xSemaphoreTake(_taskStatsLock, portMAX_DELAY);
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        std::vector<TaskStatus_t> tasks(uxTaskGetNumberOfTasks() + 4);
+        configRUN_TIME_COUNTER_TYPE totalRunTime = 0;
+        UBaseType_t taskCount = uxTaskGetSystemState(tasks.data(), tasks.size(), &totalRunTime);
+        if (taskCount == 0)
         {
-            ESP_LOGE(TAG, "Invalid command topic: %s", topic.c_str());
+            xSemaphoreGive(_taskStatsLock);
+            ESP_LOGW(TAG, "Failed to read the task system state");
             return;
         }
-        
-        std::string commandName = topic.substr(pos + 1);
-        std::string result = _mqttIoTClient.ActivateCommand(commandName, payload);
-        if (result.length() > 0)
+
+        // CPU usage is measured since the previous report, as a percentage of a single core
+        configRUN_TIME_COUNTER_TYPE elapsed = totalRunTime - _lastTotalRunTime;
+        _lastTotalRunTime = totalRunTime;
+
+        ESP_LOGI(TAG, "%-16s %6s %5s %10s", "Task", "CPU%", "Prio", "Stack HWM");
+        // Only the tasks of this snapshot are kept, so deleted tasks do not accumulate
+        std::map<UBaseType_t, configRUN_TIME_COUNTER_TYPE> taskRunTime;
+        for (UBaseType_t i = 0; i < taskCount; ++i)
         {
-            std::string response = "{\"status\": 200, \"payload\": " + result + "}";
-            int msg_id = _mqttIoTClient.PublishResponse(commandName, response);
-            if (msg_id == -1)
+            const TaskStatus_t& task = tasks[i];
+            auto lastRunTime = _lastTaskRunTime.find(task.xTaskNumber);
+            configRUN_TIME_COUNTER_TYPE taskElapsed = task.ulRunTimeCounter - 
+                (lastRunTime != _lastTaskRunTime.end() ? lastRunTime->second : 0);
+            taskRunTime[task.xTaskNumber] = task.ulRunTimeCounter;
+            float cpuPercent = elapsed > 0 ? (100.0f * taskElapsed) / elapsed : 0.0f;
+            ESP_LOGI(TAG, "%-16s %5.1f%% %5u %10" PRIu32, task.pcTaskName, cpuPercent, (unsigned int)task.uxCurrentPriority, 
+                (uint32_t)task.usStackHighWaterMark);
+        }
+        _lastTaskRunTime.swap(taskRunTime);
+#else
+        struct TaskStackStats
+        {
+            char name[configMAX_TASK_NAME_LEN];
+            uint32_t stackHighWaterMark;
+        };
+        std::array<TaskStackStats, MAX_TRACKED_TASKS + 1> tasks {};
+        size_t taskCount = 0;
+
+        portENTER_CRITICAL(&g_createdTasksLock);
+        for (size_t i = 0; i < g_createdTaskCount; ++i)
+        {
+            memcpy(tasks[taskCount++].name, g_createdTaskNames[i], configMAX_TASK_NAME_LEN);
+        }
+        portEXIT_CRITICAL(&g_createdTasksLock);
+        // The network task belongs to esp-mqtt, it is known once it delivered an event
+        if (_networkTaskHandle != nullptr)
+        {
+            strlcpy(tasks[taskCount++].name, pcTaskGetName(_networkTaskHandle), configMAX_TASK_NAME_LEN);
+        }
+
+        // No task can be deleted between the lookup and the stack check while the scheduler is suspended
+        vTaskSuspendAll();
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            TaskHandle_t taskHandle = xTaskGetHandle(tasks[i].name);
+            tasks[i].stackHighWaterMark = taskHandle != nullptr ? (uint32_t)uxTaskGetStackHighWaterMark(taskHandle) : UINT32_MAX;
+        }
+        xTaskResumeAll();
+
+        ESP_LOGI(TAG, "%-16s %10s (enable CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS for CPU usage)", "Task", "Stack HWM");
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            if (tasks[i].stackHighWaterMark != UINT32_MAX)
             {
-                ESP_LOGE(TAG, "Failed to send command response");
+                ESP_LOGI(TAG, "%-16s %10" PRIu32, tasks[i].name, tasks[i].stackHighWaterMark);
             }
         }
+#endif
+        xSemaphoreGive(_taskStatsLock);
+        ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes, minimum ever: %" PRIu32 " bytes", esp_get_free_heap_size(), 
+            esp_get_minimum_free_heap_size());
     }
 
-    void MqttIoTClient::OnDesiredPropertyUpdate(const std::string& propertyName, const std::string& propertyValue) 
+
+    void MqttIoTClient::OnDesiredPropertyStored(std::string_view propertyName, std::string_view propertyValue)
     {
-        ESP_LOGI(TAG, "Updating desired property: %s = %s", propertyName.c_str(), propertyValue.c_str());
-        // Custom logic to handle the desired property update
-        _desiredProperties[propertyName] = propertyValue;
-        // Invoke any callback if necessary
-        if (_desiredPropertyCallback) 
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        if (propertyName == "contentEncoding")
         {
-            try
-            {
-                _desiredPropertyCallback(this, propertyName, propertyValue);
-            }
-            catch (const std::exception& e)
+            _isCompressionAccepted = propertyValue == "lzss";
+            ESP_LOGI(TAG, "Outbound compression %s", _isCompressionAccepted ? "enabled" : "disabled");
+        }
+#endif
+    }
+
+    void MqttIoTClient::OnDesiredPropertiesChanged(const DesiredPropertyList_t& properties)
+    {
+        // Exceptions of the callbacks are caught by the dispatcher
+        if (_desiredPropertiesCallback)
+        {
+            std::vector<DesiredProperty_t> changedProperties;
+            changedProperties.reserve(properties.size());
+            for (const auto& it : properties)
             {
-                ESP_LOGE(TAG, "Exception while processing desired property update: %s", e.what());
+                changedProperties.emplace_back(it->first, it->second);
             }
-            catch (...)
+            _desiredPropertiesCallback(this, changedProperties);
+        }
+        else if (_desiredPropertyCallback) 
+        {
+            for (const auto& it : properties)
             {
-                ESP_LOGE(TAG, "Unknown exception while processing desired property update");
+                _desiredPropertyCallback(this, it->first, it->second);
             }
         }
     }
 
-    std::string MqttIoTClient::ActivateCommand(const std::string& commandName, const std::string& commandPayload) 
+    bool MqttIoTClient::PublishTwinRequest(std::string_view requestId)
+    {
+        auto topic = MakeTopic(_topics.GetTwinGetTopic(), requestId);
+        return Publish(topic, "") != -1;
+    }
+
+    std::string MqttIoTClient::ExecuteCommand(std::string_view commandName, std::string_view commandPayload) 
     {
-        ESP_LOGI(TAG, "Activating command: %s with payload: %s", commandName.c_str(), commandPayload.c_str());
+        const int commandNameLength = commandName.length();
+        ESP_LOGI(TAG, "Activating command: %.*s with payload: %.*s", commandNameLength, commandName.data(), 
+            (int)commandPayload.length(), commandPayload.data());
 
         // Check if a command callback is registered
         if (!_commandCallback) 
         {
-            ESP_LOGW(TAG, "No command callback registered for %s", commandName.c_str());
+            ESP_LOGW(TAG, "No command callback registered for %.*s", commandNameLength, commandName.data());
             // Return a response indicating that no callback is registered for handling commands
             return "{\"error\": \"No command callback registered\"}";
         }
@@ -353,24 +1076,24 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
             std::string result = _commandCallback(this, commandName, commandPayload);
 
             // Log and return the result of the command execution
-            ESP_LOGI(TAG, "Command %s processed with result: %s", commandName.c_str(), result.c_str());
+            ESP_LOGI(TAG, "Command %.*s processed with result: %s", commandNameLength, commandName.data(), result.c_str());
             return result;
         } 
         catch (const std::exception& e) 
         {
             // Log any exceptions thrown by the command callback
-            ESP_LOGE(TAG, "Exception while executing command %s: %s", commandName.c_str(), e.what());
+            ESP_LOGE(TAG, "Exception while executing command %.*s: %s", commandNameLength, commandName.data(), e.what());
             return "{\"error\": \"Exception occurred while processing command\"}";
         }
         catch (...) 
         {
             // Log any unknown exceptions thrown by the command callback
-            ESP_LOGE(TAG, "Unknown exception while executing command %s", commandName.c_str());
+            ESP_LOGE(TAG, "Unknown exception while executing command %.*s", commandNameLength, commandName.data());
             return "{\"error\": \"Unknown exception occurred while processing command\"}";
         }
     }
 
-    bool MqttIoTClient::PublishResponse(const std::string& subTopic, const std::string& response) 
+    bool MqttIoTClient::PublishResponse(std::string_view commandName, std::string_view response) 
     {
         //first check if the client is connected
         if (IsConnected() == false)
@@ -379,10 +1102,12 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
             return false;
         }
 
-        auto responseTopic = _responsesTopic + subTopic;
+        auto responseTopic = MakeTopic(_topics.GetResponsesTopic(), commandName);
 
-        ESP_LOGI(TAG, "Publishing response to %s: %s", responseTopic.c_str(), response.c_str());
-        int msg_id = esp_mqtt_client_publish(_client, responseTopic.c_str(), response.c_str(), response.length(), MQTT_QOS, 0);
+        ESP_LOGI(TAG, "Publishing response to %s: %.*s", responseTopic.c_str(), (int)response.length(), response.data());
+        const int64_t publishStartTime = esp_timer_get_time();
+        int msg_id = Publish(responseTopic, response);
+        TraceStage(StallDetector::Stage::Publish, publishStartTime, msg_id);
         if (msg_id == -1) 
         {
             ESP_LOGE(TAG, "Failed to publish response");
@@ -392,20 +1117,99 @@ void log_sha256_hash(const unsigned char* data, size_t data_len, const char* lab
     }
 
 
-    void MqttIoTClient::DesiredPropertyHandler::HandleMessage(const std::string& topic, const std::string& payload)
+    bool MqttIoTClient::WaitUntil(const std::function<bool()>& condition, uint32_t timeoutMs) const
     {
-        ESP_LOGI(TAG, "Received desired property update: %s with payload: %s", topic.c_str(), payload.c_str());
+        const int64_t deadline = esp_timer_get_time() + static_cast<int64_t>(timeoutMs) * 1000;
+        while (!condition())
+        {
+            if (esp_timer_get_time() >= deadline)
+            {
+                return false;
+            }
+            vTaskDelay(pdMS_TO_TICKS(20));
+        }
+        return true;
+    }
 
-        //the property name is the last part of the topic
-        auto pos = topic.find_last_of('/');
-        if (pos == std::string::npos)
+    uint32_t MqttIoTClient::GetDutyCycleIntervalMs() const
+    {
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        const PoolPropertyMap& desiredProperties = _messageDispatcher.GetDesiredProperties();
+        auto it = desiredProperties.find(PoolString(CONFIG_IOT_CLIENT_DUTY_CYCLE_INTERVAL_PROPERTY));
+        if (it != desiredProperties.end())
         {
-            ESP_LOGE(TAG, "Invalid desired property topic: %s", topic.c_str());
-            return;
+            try
+            {
+                int intervalSeconds = std::stoi(std::string(it->second));
+                if (intervalSeconds > 0)
+                {
+                    return intervalSeconds * 1000;
+                }
+            }
+            catch (const std::exception&)
+            {
+                ESP_LOGW(TAG, "Invalid %s value: %s", it->first.c_str(), it->second.c_str());
+            }
         }
-        
-        std::string propertyName = topic.substr(pos + 1);
-        _mqttIoTClient.OnDesiredPropertyUpdate(propertyName, payload);
+        return CONFIG_IOT_CLIENT_DUTY_CYCLE_DEFAULT_INTERVAL_S * 1000;
+#else
+        return 0;
+#endif
+    }
+
+    void MqttIoTClient::RunDutyCycle()
+    {
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+        if (!WaitUntil([this]() { return IsConnected() && _pendingSubscriptions == 0; }, CONFIG_IOT_CLIENT_DUTY_CYCLE_CONNECT_TIMEOUT_MS))
+        {
+            ESP_LOGE(TAG, "Could not connect to the broker, %u telemetry messages are kept for the next cycle", 
+                (unsigned int)_dutyCycleState.GetQueuedTelemetryCount());
+        }
+        else
+        {
+            size_t sentCount = _dutyCycleState.FlushTelemetry([this](std::string_view telemetrySubTopicName, std::string_view telemetryData)
+            {
+                return PublishTelemetry(telemetrySubTopicName, telemetryData);
+            });
+            ESP_LOGI(TAG, "Flushed %u queued telemetry messages", (unsigned int)sentCount);
+
+            // Let the broker deliver the pending commands and desired properties, then wait until they are handled
+            // and all QoS 1 messages, including the command responses, are acknowledged
+            vTaskDelay(pdMS_TO_TICKS(CONFIG_IOT_CLIENT_DUTY_CYCLE_SETTLE_TIME_MS));
+            if (!WaitUntil([this]() { return uxQueueMessagesWaiting(_dispatchQueue) == 0 && !_isDispatching && 
+                esp_mqtt_client_get_outbox_size(_client) == 0 && !IsTwinSyncOutstanding() && 
+                _dutyCycleState.IsFlushedTelemetryAcknowledged(); }, CONFIG_IOT_CLIENT_DUTY_CYCLE_CONNECT_TIMEOUT_MS))
+            {
+                ESP_LOGW(TAG, "Pending messages were not completed before going to sleep");
+            }
+
+            // An OTA download keeps the device awake, it reboots into the new image when done
+            if (_otaUpdater.IsInProgress() && !WaitUntil([this]() { return !_otaUpdater.IsInProgress(); }, OTA_DUTY_CYCLE_TIMEOUT_MS))
+            {
+                ESP_LOGW(TAG, "OTA update did not complete before going to sleep");
+            }
+            esp_mqtt_client_disconnect(_client);
+        }
+
+        esp_mqtt_client_stop(_client);
+        // Only the telemetry the broker acknowledged leaves the RTC memory, the rest is sent again in the next cycle
+        size_t acknowledgedCount = _dutyCycleState.DropAcknowledgedTelemetry();
+        ESP_LOGI(TAG, "%u telemetry messages acknowledged", (unsigned int)acknowledgedCount);
+        xSemaphoreTake(_reportedPropertiesLock, portMAX_DELAY);
+        _dutyCycleState.SaveProperties(_messageDispatcher.GetDesiredProperties(), _reportedProperties);
+        xSemaphoreGive(_reportedPropertiesLock);
+
+        // Awake time is the figure that sets the battery life, measure it from the wake up (the timer restarts on each boot)
+        uint32_t awakeTimeMs = esp_timer_get_time() / 1000;
+        _dutyCycleState.RecordAwakeTime(awakeTimeMs);
+        uint32_t intervalMs = GetDutyCycleIntervalMs();
+        ESP_LOGI(TAG, "Cycle %" PRIu32 " awake for %" PRIu32 " ms (average %" PRIu32 " ms), sleeping for %" PRIu32 " ms", 
+            _dutyCycleState.GetCycleCount(), awakeTimeMs, _dutyCycleState.GetAverageAwakeTimeMs(), intervalMs);
+
+        esp_deep_sleep(static_cast<uint64_t>(intervalMs) * 1000);
+#else
+        ESP_LOGE(TAG, "Duty cycled mode is disabled, enable CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE");
+#endif
     }
 
     /*static*/ void MqttIoTClient::obtain_time(void)
@@ -1,8 +1,20 @@
 #pragma once
 #include "IIoTClient.h"
+#include "freertos/queue.h"
+#include "DutyCycleState.h"
+#include "OtaUpdater.h"
+#include "OtaPartitionWriter.h"
+#include "MessageBufferPool.h"
+#include "DeviceTopics.h"
+#include "MessageDispatcher.h"
+#include "LzssCodec.h"
+#include "StallDetector.h"
+#include "StartupBenchmark.h"
+#include "freertos/semphr.h"
+#include <string_view>
 namespace AzureEventGrid
 {
-    class MqttIoTClient : public IIoTClient
+    class MqttIoTClient : public IIoTClient, private IMessageDispatcherClient
     {
         friend class IIoTClient;
     public:
@@ -14,6 +26,12 @@ namespace AzureEventGrid
         std::string GetDesiredProperty(const std::string& property) override;
         std::string GetReportedProperty(const std::string& property) override;
 
+        void LogTaskStats() override;
+
+        void LogBufferPoolStats() override;
+
+        void RunDutyCycle() override;
+
         bool IsConnected() const override
         {
             return _client != nullptr && _isConnected;
@@ -24,117 +42,137 @@ namespace AzureEventGrid
         ~MqttIoTClient() override;
 
     private:
-        friend class MessageHandler;
-        friend class CommandHandler;
-        friend class DesiredPropertyHandler;
-
         MqttIoTClient(const IoTClientConfig& mqttCfg, 
-            IIoTClient::DesiredPropertyCallback_t desiredPropertyCallback, IIoTClient::CommandCallback_t commandCallback);
+            IIoTClient::DesiredPropertyCallback_t desiredPropertyCallback, IIoTClient::CommandCallback_t commandCallback,
+            IIoTClient::DesiredPropertiesCallback_t desiredPropertiesCallback);
 
         void EventHandler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data);
         static void MqttEventHandler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data) ;
         static void obtain_time(void);
-        void OnDesiredPropertyUpdate(const std::string& propertyName, const std::string& propertyValue);
         void ProcessMqttEventData(esp_mqtt_client_handle_t client, esp_mqtt_event_handle_t event);
-        std::string ActivateCommand(const std::string& commandName, const std::string& commandPayload);
-        bool PublishResponse(const std::string& subTopic, const std::string& response);
-        void ProcessDesiredPropertyUpdate(const std::string& propertyName, const std::string& propertyValue);
 
-        static MqttIoTClient *_pThis; //singleton
-
-        const std::string& GetResponsesTopic() const
-        {
-            return _responsesTopic;
-        }
+        // IMessageDispatcherClient, called on the dispatch task
+        std::string ExecuteCommand(std::string_view commandName, std::string_view commandPayload) override;
+        bool PublishResponse(std::string_view commandName, std::string_view response) override;
+        bool PublishTwinRequest(std::string_view requestId) override;
+        void OnDesiredPropertyStored(std::string_view propertyName, std::string_view propertyValue) override;
+        void OnDesiredPropertiesChanged(const DesiredPropertyList_t& properties) override;
 
-        const std::string& GetCommandsTopic() const 
-        {
-            return _commandsTopic;
-        }
-
-        const std::string& GetDesiredPropertyTopic() const 
-        {
-            return _desiredPropertyTopic;
-        }
-
-        const std::string& GetReportedPropertyTopic() const 
-        {
-            return _reportedPropertyTopic;
-        }
+        void ProcessDesiredPropertyUpdate(const std::string& propertyName, const std::string& propertyValue);
+        static void DispatchTask(void* pvParameters);
+        struct InboundMessage;
+        void DispatchMessage(const InboundMessage& message);
+        void PostTwinSyncSteps(uint32_t steps, bool isNewConnection);
+        void RunTwinSyncSteps();
+        bool IsTwinSyncOutstanding() const;
+        int PublishTelemetry(std::string_view telemetrySubTopicName, std::string_view telemetryData);
+        bool PublishReportedProperty(std::string_view reportedPropertyName, std::string_view reportedPropertyValue);
+        bool HasReportedProperty(std::string_view reportedPropertyName);
+        std::string_view EncodePayload(std::string_view payload, PoolString& buffer);
+        void TraceStage(StallDetector::Stage stage, int64_t startTimeUs, int detail);
+        void PublishStallReport();
+        void LogCompressionStats() const;
+        static PoolString MakeTopic(const std::string& topicPrefix, std::string_view subTopic);
+        int Publish(const PoolString& topic, std::string_view payload);
+        bool WaitUntil(const std::function<bool()>& condition, uint32_t timeoutMs) const;
+        uint32_t GetDutyCycleIntervalMs() const;
 
-        const std::string& GetTelemetryTopic() const 
-        {
-            return _telemetryTopic;
-        }
+        static MqttIoTClient *_pThis; //singleton
 
-        
-        std::string _responsesTopic;
-        std::string _commandsTopic;
-        std::string _desiredPropertyTopic;
-        std::string _reportedPropertyTopic;
-        std::string _telemetryTopic;
         bool _isConnected {};
+        int64_t _connectStartTime {};
         
         const std::string _clientId;
+        const DeviceTopics _topics;
         IIoTClient::CommandCallback_t _commandCallback;
         IIoTClient::DesiredPropertyCallback_t _desiredPropertyCallback;
+        IIoTClient::DesiredPropertiesCallback_t _desiredPropertiesCallback;
         
         esp_mqtt_client_handle_t _client;
-        std::map<std::string, std::string> _desiredProperties;
-        std::map<std::string, std::string> _reportedProperties;
-
-        static const int MQTT_QOS = 1;
-
-
+        PoolPropertyMap _reportedProperties;
+        // Reported properties are published from the application tasks, the dispatch task and the network task (OTA progress)
+        SemaphoreHandle_t _reportedPropertiesLock {};
 
-       
-        class MessageHandler 
+        // Inbound messages are copied by the network task and handled by the dispatch task,
+        // so slow user callbacks do not block the TLS connection
+        struct InboundMessage
         {
-        protected:
-            MqttIoTClient &_mqttIoTClient;
-
-        public:
-            MessageHandler(MqttIoTClient* pClient) : _mqttIoTClient(*pClient) {}
-            virtual ~MessageHandler() = default;
-
-            // Provide a method to get the topic string from derived classes
-            virtual const std::string& GetTopicPrefix() const = 0;
-
-            // Implement common logic for checking responsibility based on the topic prefix
-            virtual bool IsResponsibleFor(const std::string& topic) const 
-            {
-                return topic.find(GetTopicPrefix()) == 0;
-            }
-
-            virtual void HandleMessage(const std::string& topic, const std::string& payload) = 0;
+            PoolString topic;
+            PoolString payload;
+            uint16_t packetId;
+            bool isRedelivery;
+            bool isRetained;
+            int64_t queuedTimeUs;
         };
-
-        class CommandHandler : public MessageHandler 
+        QueueHandle_t _dispatchQueue {};
+        TaskHandle_t _dispatchTaskHandle {};
+        volatile bool _isDispatching {};
+        TaskHandle_t _networkTaskHandle {};
+        uint32_t _taskStatsPeriodMs;
+        std::map<UBaseType_t, configRUN_TIME_COUNTER_TYPE> _lastTaskRunTime;
+        configRUN_TIME_COUNTER_TYPE _lastTotalRunTime {};
+        SemaphoreHandle_t _taskStatsLock {};
+
+        DutyCycleState _dutyCycleState;
+        volatile int _pendingSubscriptions {};
+
+        OtaPartitionWriter _otaPartitionWriter;
+        OtaUpdater _otaUpdater;
+        bool _isRunningImageValidated {};
+
+        // Commands, desired properties and the twin resynchronization after a connect, shared with the fleet simulator
+        MessageDispatcher _messageDispatcher;
+#if CONFIG_IOT_CLIENT_TWIN_SYNC
+        esp_timer_handle_t _twinSyncTimer {};
+        static const uint32_t TWIN_SYNC_TIMEOUT_MS = CONFIG_IOT_CLIENT_TWIN_SYNC_TIMEOUT_MS;
+        // The network task posts the twin sync steps, the dispatch task runs them on the dispatcher
+        static const uint32_t TWIN_SYNC_BEGIN = 1;
+        static const uint32_t TWIN_SYNC_REQUEST = 2;
+        volatile uint32_t _pendingTwinSyncSteps {};
+        portMUX_TYPE _twinSyncLock = portMUX_INITIALIZER_UNLOCKED;
+#else
+        static const uint32_t TWIN_SYNC_TIMEOUT_MS = 0;
+#endif
+
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+        StallDetector _stallDetector;
+#endif
+#if CONFIG_IOT_CLIENT_STALL_WATCHDOG
+        // The network task only runs our code on MQTT events, a periodic custom event keeps feeding its watchdog
+        esp_timer_handle_t _watchdogHeartbeatTimer {};
+        volatile bool _isNetworkTaskWatched {};
+        bool _isDispatchTaskWatched {};    // written and read by the dispatch task only
+        static const uint32_t WATCHDOG_HEARTBEAT_PERIOD_MS = CONFIG_ESP_TASK_WDT_TIMEOUT_S * 1000 / 2;
+#endif
+
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+        StartupBenchmark _startupBenchmark;
+        // Disconnects from the broker a while after the subscriptions, the reconnection is then measured
+        esp_timer_handle_t _benchmarkDisconnectTimer {};
+        static const uint32_t BENCHMARK_SETTLE_TIME_MS = 1000;
+#endif
+
+#if CONFIG_IOT_CLIENT_COMPRESSION
+        // Outbound payloads are compressed by the publishing task, the encoder tables are shared under a lock
+        LzssEncoder<CONFIG_IOT_CLIENT_COMPRESSION_WINDOW_BITS, CONFIG_IOT_CLIENT_COMPRESSION_LOOKAHEAD_BITS> _payloadEncoder;
+        SemaphoreHandle_t _payloadEncoderLock {};
+        volatile bool _isCompressionAccepted {};
+        struct CompressionStats
         {
-        public:
-            using MessageHandler::MessageHandler;
-            
-            const std::string& GetTopicPrefix() const override 
-            {
-                return _mqttIoTClient.GetCommandsTopic();
-            }
-
-            void HandleMessage(const std::string& topic, const std::string& payload) override;
+            uint32_t messageCount;
+            uint32_t compressedCount;
+            uint64_t inputBytes;
+            uint64_t outputBytes;
+            int64_t timeUs;
         };
+        CompressionStats _compressionStats {};
+#endif
 
-        class DesiredPropertyHandler : public MessageHandler 
-        {
-        public:
-            using MessageHandler::MessageHandler;
-            
-            const std::string& GetTopicPrefix() const override 
-            {
-                return _mqttIoTClient.GetDesiredPropertyTopic();
-            }
-
-            void HandleMessage(const std::string& topic, const std::string& payload) override;
-        };
+        // esp-mqtt splits messages larger than its buffer, only the first fragment carries the topic
+        PoolString _fragmentTopic;
+        PoolString _fragmentPayload;
 
-        std::array<std::unique_ptr<MessageHandler>, 2> _messageHandlers;
+        static const int MQTT_QOS = 1;
+        static const uint32_t OTA_DUTY_CYCLE_TIMEOUT_MS = 10 * 60 * 1000;
     };
 }
\ No newline at end of file
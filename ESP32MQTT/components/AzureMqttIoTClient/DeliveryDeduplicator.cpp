@@ -0,0 +1,183 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include <string.h>
+#include "DeliveryDeduplicator.h"
+
+static const char *TAG = "DeliveryDeduplicator";
+
+namespace AzureEventGrid
+{
+    namespace
+    {
+        const uint32_t FNV_OFFSET_BASIS = 2166136261u;
+        const uint32_t FNV_PRIME = 16777619u;
+
+        // Commands without a correlation id are the common case, look for the member name before parsing
+        bool FindCorrelationId(std::string_view payload, PoolString& correlationId)
+        {
+            static const std::string_view memberName = "\"correlationId\"";
+            if (payload.find(memberName) == std::string_view::npos)
+            {
+                return false;
+            }
+
+            cJSON* root = cJSON_ParseWithLength(payload.data(), payload.length());
+            cJSON* item = cJSON_GetObjectItemCaseSensitive(root, "correlationId");
+            bool isFound = cJSON_IsString(item) && item->valuestring[0] != '\0';
+            if (isFound)
+            {
+                correlationId = item->valuestring;
+            }
+            cJSON_Delete(root);
+            return isFound;
+        }
+    }
+
+    /*static*/ uint32_t DeliveryDeduplicator::Hash(uint32_t hash, std::string_view data)
+    {
+        for (unsigned char c : data)
+        {
+            hash = (hash ^ c) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    /*static*/ DeliveryDeduplicator::MessageKey DeliveryDeduplicator::MakeKey(std::string_view topic, std::string_view payload, 
+        uint16_t packetId, bool isRedelivery)
+    {
+        MessageKey key {};
+        key.packetId = packetId;
+        key.isRedelivery = isRedelivery;
+
+        // The terminator keeps "ab"+"c" and "a"+"bc" apart
+        uint32_t hash = Hash(FNV_OFFSET_BASIS, topic);
+        hash = Hash(hash, std::string_view("", 1));
+
+        PoolString correlationId;
+        key.hasCorrelationId = FindCorrelationId(payload, correlationId);
+        key.hash = Hash(hash, key.hasCorrelationId ? std::string_view(correlationId) : payload);
+        return key;
+    }
+
+    bool DeliveryDeduplicator::IsDuplicate(const MessageKey& key, std::string_view* pCachedResponse)
+    {
+#if CONFIG_IOT_CLIENT_DEDUP_CACHE_SIZE > 0
+        const int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < _entryCount; ++i)
+        {
+            const Entry& entry = _entries[i];
+            if (entry.key.hash != key.hash || entry.key.hasCorrelationId != key.hasCorrelationId || 
+                now - entry.receivedTimeUs > static_cast<int64_t>(CONFIG_IOT_CLIENT_DEDUP_WINDOW_MS) * 1000)
+            {
+                continue;
+            }
+
+            // The broker resends an unacknowledged message with its packet id and the DUP flag
+            bool isSameDelivery = key.hasCorrelationId || (key.isRedelivery && key.packetId == entry.key.packetId);
+            if (isSameDelivery)
+            {
+                ++_suppressedCount;
+                ESP_LOGI(TAG, "Duplicate delivery of packet %u suppressed, %u so far", key.packetId, (unsigned int)_suppressedCount);
+                if (pCachedResponse != nullptr)
+                {
+                    *pCachedResponse = entry.response;
+                }
+                return true;
+            }
+        }
+#endif
+        return false;
+    }
+
+    void DeliveryDeduplicator::Remember(const MessageKey& key, std::string_view response)
+    {
+#if CONFIG_IOT_CLIENT_DEDUP_CACHE_SIZE > 0
+        Entry& entry = _entries[_nextEntry];
+        entry.key = key;
+        entry.receivedTimeUs = esp_timer_get_time();
+        entry.response = response;
+
+        _nextEntry = (_nextEntry + 1) % _entries.size();
+        if (_entryCount < _entries.size())
+        {
+            ++_entryCount;
+        }
+#endif
+    }
+
+    /*static*/ bool DeliveryDeduplicator::ParseVersionedValue(std::string_view payload, uint32_t& version, PoolString& value)
+    {
+        static const std::string_view memberName = "\"$version\"";
+        if (payload.empty() || payload.front() != '{' || payload.find(memberName) == std::string_view::npos)
+        {
+            return false;
+        }
+
+        cJSON* root = cJSON_ParseWithLength(payload.data(), payload.length());
+        bool isVersioned = ParseVersionedValue(root, version, value);
+        cJSON_Delete(root);
+        return isVersioned;
+    }
+
+    /*static*/ bool DeliveryDeduplicator::ParseVersionedValue(const cJSON* item, uint32_t& version, PoolString& value)
+    {
+        cJSON* versionItem = cJSON_GetObjectItemCaseSensitive(item, "$version");
+        cJSON* valueItem = cJSON_GetObjectItemCaseSensitive(item, "value");
+        if (!cJSON_IsNumber(versionItem) || versionItem->valuedouble < 0 || valueItem == nullptr)
+        {
+            return false;
+        }
+
+        version = static_cast<uint32_t>(versionItem->valuedouble);
+        // Plain values are passed to the application as they were before versioning
+        GetPlainValue(valueItem, value);
+        return true;
+    }
+
+    /*static*/ void DeliveryDeduplicator::GetPlainValue(const cJSON* item, PoolString& value)
+    {
+        if (cJSON_IsString(item))
+        {
+            value = item->valuestring;
+            return;
+        }
+
+        char* printedValue = cJSON_PrintUnformatted(item);
+        value = printedValue != nullptr ? printedValue : "";
+        cJSON_free(printedValue);
+    }
+
+    bool DeliveryDeduplicator::IsStaleVersion(std::string_view propertyName, uint32_t version)
+    {
+        auto it = _desiredVersions.find(propertyName);
+        if (it == _desiredVersions.end())
+        {
+            _desiredVersions.emplace(PoolString(propertyName), version);
+            return false;
+        }
+
+        if (version <= it->second)
+        {
+            ESP_LOGW(TAG, "Dropping desired property %.*s version %" PRIu32 ", version %" PRIu32 " is already applied", 
+                (int)propertyName.length(), propertyName.data(), version, it->second);
+            return true;
+        }
+
+        it->second = version;
+        return false;
+    }
+
+    void DeliveryDeduplicator::RecordVersion(std::string_view propertyName, uint32_t version)
+    {
+        auto it = _desiredVersions.find(propertyName);
+        if (it == _desiredVersions.end())
+        {
+            _desiredVersions.emplace(PoolString(propertyName), version);
+        }
+        else if (version > it->second)
+        {
+            it->second = version;
+        }
+    }
+}
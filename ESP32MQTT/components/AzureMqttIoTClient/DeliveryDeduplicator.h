@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <array>
+#include <map>
+#include "sdkconfig.h"
+#include "MessageBufferPool.h"
+
+struct cJSON;
+
+namespace AzureEventGrid
+{
+    // Recognizes QoS 1 messages that the broker delivers again, e.g. after a reconnect, so they are not handled twice.
+    // A message is a duplicate of one remembered within the window when:
+    //   - both carry the same "correlationId" member on the same topic, or
+    //   - the topic, payload and packet id are equal and the packet is flagged as a redelivery (DUP)
+    // Identical commands sent on purpose are not flagged and are handled again. Packet ids alone are not enough,
+    // they restart after a clean session reconnect.
+    // Desired property updates may carry a version: {"$version": <n>, "value": <value>}, stale versions are dropped.
+    class DeliveryDeduplicator
+    {
+    public:
+        struct MessageKey
+        {
+            uint32_t hash;
+            uint16_t packetId;
+            bool isRedelivery;
+            bool hasCorrelationId;
+        };
+
+        static MessageKey MakeKey(std::string_view topic, std::string_view payload, uint16_t packetId, bool isRedelivery);
+
+        // Returns true when the message was already handled, pCachedResponse then points to its response (empty when it had none)
+        bool IsDuplicate(const MessageKey& key, std::string_view* pCachedResponse = nullptr);
+
+        // Remember a handled message and the response that was published for it
+        void Remember(const MessageKey& key, std::string_view response = std::string_view());
+
+        // Splits a versioned desired property payload into version and value. Returns false for an unversioned payload.
+        static bool ParseVersionedValue(std::string_view payload, uint32_t& version, PoolString& value);
+        static bool ParseVersionedValue(const cJSON* item, uint32_t& version, PoolString& value);
+
+        // The value passed to the application: strings without their JSON quotes, other values as JSON
+        static void GetPlainValue(const cJSON* item, PoolString& value);
+
+        // Returns true when an update of the property with this version was already applied, records newer versions
+        bool IsStaleVersion(std::string_view propertyName, uint32_t version);
+
+        // Records the version of a property whose value is already applied, so older updates of it are dropped later
+        void RecordVersion(std::string_view propertyName, uint32_t version);
+
+        size_t GetSuppressedCount() const { return _suppressedCount; }
+
+    private:
+        struct Entry
+        {
+            MessageKey key {};
+            int64_t receivedTimeUs = 0;
+            PoolString response;
+        };
+
+        static uint32_t Hash(uint32_t hash, std::string_view data);
+
+        std::array<Entry, CONFIG_IOT_CLIENT_DEDUP_CACHE_SIZE> _entries;
+        size_t _nextEntry = 0;   // the oldest entry is overwritten first
+        size_t _entryCount = 0;
+        size_t _suppressedCount = 0;
+        std::map<PoolString, uint32_t, std::less<>, PoolAllocator<std::pair<const PoolString, uint32_t>>> _desiredVersions;
+    };
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace AzureEventGrid
+{
+    // Topic layout and message envelopes of a device: device/<clientId>/<kind>/<name>
+    // Header only and free of ESP-IDF dependencies, so the host tools (e.g. the fleet simulator) speak the same protocol.
+    class DeviceTopics
+    {
+    public:
+        explicit DeviceTopics(const std::string& clientId) :
+            _responsesTopic(MakeTopicPrefix(clientId, "responses")),
+            _commandsTopic(MakeTopicPrefix(clientId, "commands")),
+            _desiredPropertyTopic(MakeTopicPrefix(clientId, "twin/desired")),
+            _reportedPropertyTopic(MakeTopicPrefix(clientId, "twin/reported")),
+            _twinGetTopic(MakeTopicPrefix(clientId, "twin/get")),
+            _twinDocumentTopic(MakeTopicPrefix(clientId, "twin/document")),
+            _telemetryTopic(MakeTopicPrefix(clientId, "telemetry")),
+            _otaTopic(MakeTopicPrefix(clientId, "ota")),
+            _diagnosticsTopic(MakeTopicPrefix(clientId, "diagnostics"))
+        {
+        }
+
+        const std::string& GetResponsesTopic() const { return _responsesTopic; }
+        const std::string& GetCommandsTopic() const { return _commandsTopic; }
+        const std::string& GetDesiredPropertyTopic() const { return _desiredPropertyTopic; }
+        const std::string& GetReportedPropertyTopic() const { return _reportedPropertyTopic; }
+        // Twin request: twin/get/<requestId>, answered on twin/document/<requestId> with
+        // {"$version": <document version>, "desired": {"<name>": <value> or {"$version": <n>, "value": <value>}, ...}}
+        const std::string& GetTwinGetTopic() const { return _twinGetTopic; }
+        const std::string& GetTwinDocumentTopic() const { return _twinDocumentTopic; }
+        const std::string& GetTelemetryTopic() const { return _telemetryTopic; }
+        const std::string& GetOtaTopic() const { return _otaTopic; }
+        const std::string& GetDiagnosticsTopic() const { return _diagnosticsTopic; }
+
+        // The command or property name is the last segment of the topic, empty when the topic has no segments
+        static std::string_view GetLastSegment(std::string_view topic)
+        {
+            auto pos = topic.find_last_of('/');
+            return pos == std::string_view::npos ? std::string_view() : topic.substr(pos + 1);
+        }
+
+        // The response published for a command: {"status": 200, "payload": <command result>}
+        template<typename String_t>
+        static void AppendCommandResponse(String_t& response, std::string_view result)
+        {
+            static const std::string_view responsePrefix = "{\"status\": 200, \"payload\": ";
+            response.reserve(response.length() + responsePrefix.length() + result.length() + 1);
+            response.append(responsePrefix).append(result).append("}");
+        }
+
+    private:
+        static std::string MakeTopicPrefix(const std::string& clientId, const char* kind)
+        {
+            return std::string("device/") + clientId + "/" + kind + "/";
+        }
+
+        std::string _responsesTopic;
+        std::string _commandsTopic;
+        std::string _desiredPropertyTopic;
+        std::string _reportedPropertyTopic;
+        std::string _twinGetTopic;
+        std::string _twinDocumentTopic;
+        std::string _telemetryTopic;
+        std::string _otaTopic;
+        std::string _diagnosticsTopic;
+    };
+}
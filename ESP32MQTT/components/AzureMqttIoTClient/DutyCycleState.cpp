@@ -0,0 +1,247 @@
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <algorithm>
+#include "DutyCycleState.h"
+
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+
+static const char *TAG = "DutyCycleState";
+
+namespace AzureEventGrid
+{
+    namespace
+    {
+        const uint32_t RTC_STATE_MAGIC = 0x49544453; // "SDTI"
+
+        // Entries are stored as two consecutive null terminated strings: "name\0value\0"
+        struct RtcState
+        {
+            uint32_t magic;
+            uint32_t cycleCount;
+            uint32_t lastAwakeTimeMs;
+            uint32_t awakeTimeCycles;
+            uint64_t totalAwakeTimeMs;
+            uint16_t propertiesLength;
+            uint16_t telemetryLength;
+            uint16_t telemetryCount;
+            char properties[CONFIG_IOT_CLIENT_DUTY_CYCLE_PROPERTIES_SIZE];
+            char telemetry[CONFIG_IOT_CLIENT_DUTY_CYCLE_TELEMETRY_SIZE];
+        };
+
+        RTC_DATA_ATTR RtcState g_rtcState;
+
+        const char DESIRED_PREFIX = 'D';
+        const char REPORTED_PREFIX = 'R';
+
+        bool AppendEntry(char* buffer, size_t capacity, uint16_t& length, std::string_view name, std::string_view value)
+        {
+            size_t needed = name.length() + value.length() + 2;
+            if (length + needed > capacity)
+            {
+                return false;
+            }
+
+            memcpy(buffer + length, name.data(), name.length());
+            length += name.length();
+            buffer[length++] = '\0';
+            memcpy(buffer + length, value.data(), value.length());
+            length += value.length();
+            buffer[length++] = '\0';
+            return true;
+        }
+
+        // Calls entryHandler(name, value, entryEnd) for each entry until it returns false
+        template<typename EntryHandler_t>
+        void ForEachEntry(const char* buffer, uint16_t length, EntryHandler_t entryHandler)
+        {
+            size_t pos = 0;
+            while (pos < length)
+            {
+                const char* name = buffer + pos;
+                pos += strnlen(name, length - pos) + 1;
+                if (pos >= length)
+                {
+                    ESP_LOGE(TAG, "Corrupted RTC entry");
+                    return;
+                }
+
+                const char* value = buffer + pos;
+                pos += strnlen(value, length - pos) + 1;
+                if (!entryHandler(name, value, pos))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    void DutyCycleState::BeginCycle()
+    {
+        if (esp_reset_reason() != ESP_RST_DEEPSLEEP || g_rtcState.magic != RTC_STATE_MAGIC)
+        {
+            ESP_LOGI(TAG, "Cold boot, resetting the duty cycle state");
+            memset(&g_rtcState, 0, sizeof(g_rtcState));
+            g_rtcState.magic = RTC_STATE_MAGIC;
+        }
+
+        ++g_rtcState.cycleCount;
+        ESP_LOGI(TAG, "Duty cycle %" PRIu32 ", %u queued telemetry messages", g_rtcState.cycleCount, g_rtcState.telemetryCount);
+    }
+
+    uint32_t DutyCycleState::GetCycleCount() const
+    {
+        return g_rtcState.cycleCount;
+    }
+
+    void DutyCycleState::SaveProperties(const Properties_t& desiredProperties, const Properties_t& reportedProperties)
+    {
+        uint16_t length = 0;
+        for (const auto& [prefix, properties] : {std::make_pair(DESIRED_PREFIX, &desiredProperties), std::make_pair(REPORTED_PREFIX, &reportedProperties)})
+        {
+            for (const auto& [name, value] : *properties)
+            {
+                if (!AppendEntry(g_rtcState.properties, sizeof(g_rtcState.properties), length, prefix + name, value))
+                {
+                    ESP_LOGW(TAG, "No RTC memory left to keep property %s", name.c_str());
+                }
+            }
+        }
+        g_rtcState.propertiesLength = length;
+    }
+
+    void DutyCycleState::RestoreProperties(Properties_t& desiredProperties, Properties_t& reportedProperties) const
+    {
+        ForEachEntry(g_rtcState.properties, g_rtcState.propertiesLength, [&](const char* name, const char* value, size_t)
+        {
+            auto& properties = name[0] == DESIRED_PREFIX ? desiredProperties : reportedProperties;
+            properties[PoolString(name + 1)] = value;
+            return true;
+        });
+    }
+
+    bool DutyCycleState::QueueTelemetry(std::string_view telemetrySubTopicName, std::string_view telemetryData)
+    {
+        if (!AppendEntry(g_rtcState.telemetry, sizeof(g_rtcState.telemetry), g_rtcState.telemetryLength, telemetrySubTopicName, telemetryData))
+        {
+            ESP_LOGW(TAG, "Telemetry queue is full, dropping telemetry of sub topic %.*s", (int)telemetrySubTopicName.length(), 
+                telemetrySubTopicName.data());
+            return false;
+        }
+        ++g_rtcState.telemetryCount;
+        return true;
+    }
+
+    size_t DutyCycleState::FlushTelemetry(const TelemetrySender_t& sender)
+    {
+        // The ids are recorded under the lock, a PUBACK may arrive before the sender returns.
+        // The list is allocated up front, nothing is allocated inside the critical section.
+        decltype(_flushedTelemetry) flushedTelemetry;
+        flushedTelemetry.reserve(g_rtcState.telemetryCount);
+        portENTER_CRITICAL(&_lock);
+        _flushedTelemetry.swap(flushedTelemetry);
+        portEXIT_CRITICAL(&_lock);
+
+        ForEachEntry(g_rtcState.telemetry, g_rtcState.telemetryLength, [&](const char* name, const char* value, size_t)
+        {
+            int msgId = sender(name, value);
+            if (msgId == -1)
+            {
+                return false;
+            }
+            portENTER_CRITICAL(&_lock);
+            _flushedTelemetry.push_back(FlushedTelemetry{msgId, false});
+            portEXIT_CRITICAL(&_lock);
+            return true;
+        });
+        return _flushedTelemetry.size();
+    }
+
+    void DutyCycleState::AcknowledgeTelemetry(int msgId)
+    {
+        portENTER_CRITICAL(&_lock);
+        for (auto& flushedTelemetry : _flushedTelemetry)
+        {
+            if (flushedTelemetry.msgId == msgId)
+            {
+                flushedTelemetry.isAcknowledged = true;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&_lock);
+    }
+
+    bool DutyCycleState::IsFlushedTelemetryAcknowledged() const
+    {
+        portENTER_CRITICAL(&_lock);
+        bool isAcknowledged = std::all_of(_flushedTelemetry.begin(), _flushedTelemetry.end(), 
+            [](const FlushedTelemetry& flushedTelemetry) { return flushedTelemetry.isAcknowledged; });
+        portEXIT_CRITICAL(&_lock);
+        return isAcknowledged;
+    }
+
+    size_t DutyCycleState::DropAcknowledgedTelemetry()
+    {
+        // Compact the buffer in place, the entries that were not flushed or not acknowledged keep their order
+        size_t index = 0;
+        size_t droppedCount = 0;
+        uint16_t keptLength = 0;
+        size_t entryStart = 0;
+        decltype(_flushedTelemetry) flushedTelemetry;
+        portENTER_CRITICAL(&_lock);
+        _flushedTelemetry.swap(flushedTelemetry);
+        portEXIT_CRITICAL(&_lock);
+
+        ForEachEntry(g_rtcState.telemetry, g_rtcState.telemetryLength, [&](const char*, const char*, size_t entryEnd)
+        {
+            bool isAcknowledged = index < flushedTelemetry.size() && flushedTelemetry[index].isAcknowledged;
+            ++index;
+            if (isAcknowledged)
+            {
+                ++droppedCount;
+            }
+            else
+            {
+                memmove(g_rtcState.telemetry + keptLength, g_rtcState.telemetry + entryStart, entryEnd - entryStart);
+                keptLength += entryEnd - entryStart;
+            }
+            entryStart = entryEnd;
+            return true;
+        });
+
+        g_rtcState.telemetryLength = keptLength;
+        g_rtcState.telemetryCount -= droppedCount;
+        if (g_rtcState.telemetryCount > 0)
+        {
+            ESP_LOGW(TAG, "%u telemetry messages were not acknowledged, they are kept for the next cycle", 
+                (unsigned int)g_rtcState.telemetryCount);
+        }
+        return droppedCount;
+    }
+
+    size_t DutyCycleState::GetQueuedTelemetryCount() const
+    {
+        return g_rtcState.telemetryCount;
+    }
+
+    void DutyCycleState::RecordAwakeTime(uint32_t awakeTimeMs)
+    {
+        g_rtcState.lastAwakeTimeMs = awakeTimeMs;
+        g_rtcState.totalAwakeTimeMs += awakeTimeMs;
+        ++g_rtcState.awakeTimeCycles;
+    }
+
+    uint32_t DutyCycleState::GetLastAwakeTimeMs() const
+    {
+        return g_rtcState.lastAwakeTimeMs;
+    }
+
+    uint32_t DutyCycleState::GetAverageAwakeTimeMs() const
+    {
+        return g_rtcState.awakeTimeCycles > 0 ? g_rtcState.totalAwakeTimeMs / g_rtcState.awakeTimeCycles : 0;
+    }
+}
+
+#endif //CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include "MessageBufferPool.h"
+#include "freertos/FreeRTOS.h"
+
+namespace AzureEventGrid
+{
+    // Client state kept in RTC slow memory, so it survives the deep sleep between duty cycles
+    class DutyCycleState
+    {
+    public:
+        using Properties_t = PoolPropertyMap;
+        // Returns the MQTT message id of the publish, -1 when it failed
+        using TelemetrySender_t = std::function<int(std::string_view telemetrySubTopicName, std::string_view telemetryData)>;
+
+        // Start a new cycle, the RTC state is reset unless the device woke up from deep sleep
+        void BeginCycle();
+        uint32_t GetCycleCount() const;
+
+        void SaveProperties(const Properties_t& desiredProperties, const Properties_t& reportedProperties);
+        void RestoreProperties(Properties_t& desiredProperties, Properties_t& reportedProperties) const;
+
+        bool QueueTelemetry(std::string_view telemetrySubTopicName, std::string_view telemetryData);
+        // Send the queued telemetry in order, stops at the first failure. The messages stay queued until they are acknowledged.
+        size_t FlushTelemetry(const TelemetrySender_t& sender);
+        // Called with the message id of each PUBACK, from the network task
+        void AcknowledgeTelemetry(int msgId);
+        bool IsFlushedTelemetryAcknowledged() const;
+        // Remove the acknowledged messages before going to sleep, the others are sent again in the next cycle
+        size_t DropAcknowledgedTelemetry();
+        size_t GetQueuedTelemetryCount() const;
+
+        void RecordAwakeTime(uint32_t awakeTimeMs);
+        uint32_t GetLastAwakeTimeMs() const;
+        uint32_t GetAverageAwakeTimeMs() const;
+
+    private:
+        // The flushed messages, in queue order from the start of the RTC telemetry buffer
+        struct FlushedTelemetry
+        {
+            int msgId;
+            bool isAcknowledged;
+        };
+
+        std::vector<FlushedTelemetry, PoolAllocator<FlushedTelemetry>> _flushedTelemetry;
+        mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+#include "esp_err.h"
+
+namespace AzureEventGrid
+{
+    // Destination of a streamed firmware image: the next OTA partition on the device, a fake partition in the host tests.
+    // The image is written sequentially from offset 0.
+    class IFirmwareWriter
+    {
+    public:
+        virtual ~IFirmwareWriter() = default;
+
+        virtual esp_err_t Begin(size_t imageSize) = 0;
+        virtual esp_err_t Write(const void* data, size_t length) = 0;
+        // Validate the complete image and boot it at the next restart
+        virtual esp_err_t Activate() = 0;
+        virtual void Abort() = 0;
+        virtual const char* GetName() const = 0;
+    };
+}
@@ -1,19 +1,34 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include "IoTClientConfig.h"
 #include <functional>
+#include <vector>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 namespace AzureEventGrid
 {
     class IIoTClient 
     {
     public:
-        using CommandCallback_t = std::function<std::string(IIoTClient *pClient, const std::string& commandName, const std::string& payload)>;
-        using DesiredPropertyCallback_t = std::function<void(IIoTClient *pClient, const std::string& propertyName, const std::string& propertyValue)>;
+        // The views refer to buffers owned by the client and are valid only during the callback
+        using CommandCallback_t = std::function<std::string(IIoTClient *pClient, std::string_view commandName, std::string_view payload)>;
+        using DesiredPropertyCallback_t = std::function<void(IIoTClient *pClient, std::string_view propertyName, std::string_view propertyValue)>;
+
+        // Receives the desired properties that changed together (e.g. the twin resynchronized after a connect) in one call.
+        // When it is set, it replaces the per property callback.
+        using DesiredProperty_t = std::pair<std::string_view, std::string_view>;
+        using DesiredPropertiesCallback_t = std::function<void(IIoTClient *pClient, const std::vector<DesiredProperty_t>& changedProperties)>;
 
         IIoTClient() = default;
         static IIoTClient* Initialize(const IoTClientConfig& mqttCfg, DesiredPropertyCallback_t callback,
-            CommandCallback_t commandCallback);
+            CommandCallback_t commandCallback, DesiredPropertiesCallback_t desiredPropertiesCallback = nullptr);
+
+        // Create a task placed according to the task topology (core, priority and stack size)
+        static bool CreateTask(const IoTTaskConfig& taskConfig, TaskFunction_t taskFunction, const char* name, 
+            void* parameter, TaskHandle_t* pTaskHandle = nullptr);
 
         virtual void SendTelemetry(const std::string& telemetrySubTopicName, const std::string& telemetryData) = 0;
 
@@ -22,6 +37,16 @@ namespace AzureEventGrid
         virtual std::string GetDesiredProperty(const std::string& propertyName) = 0;
         virtual std::string GetReportedProperty(const std::string& propertyName) = 0;
 
+        // Log CPU usage per task and stack high-water marks
+        virtual void LogTaskStats() = 0;
+
+        // Log the message buffer pool occupancy and the heap fragmentation
+        virtual void LogBufferPoolStats() = 0;
+
+        // Duty cycled mode: flush the queued telemetry, handle pending commands and desired properties, 
+        // then deep sleep until the next report. Does not return.
+        virtual void RunDutyCycle() = 0;
+
         IIoTClient(const IIoTClient&) = delete;
         IIoTClient& operator=(const IIoTClient&) = delete;
 
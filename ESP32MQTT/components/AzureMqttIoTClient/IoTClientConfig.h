@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include "sdkconfig.h"
+#include "IoTTaskConfig.h"
 
 namespace AzureEventGrid
 {
@@ -16,13 +18,26 @@ namespace AzureEventGrid
         size_t _clientKeyLen;
         const uint8_t* _brokerCert;
         size_t _brokerCertLen;
+        const char* _clientCertFingerprint;
+        const char* _clientKeyFingerprint;
+        const char* _brokerCertFingerprint;
+
+        IoTTaskConfig _networkTaskConfig;
+        IoTTaskConfig _dispatchTaskConfig;
+        IoTTaskConfig _sensorTaskConfig;
+        uint32_t _taskStatsPeriodMs;
 
     public:
         // Constructor
         IoTClientConfig()
             : _clientCert(nullptr), _clientCertLen(0),
               _clientKey(nullptr), _clientKeyLen(0),
-              _brokerCert(nullptr), _brokerCertLen(0) {}
+              _brokerCert(nullptr), _brokerCertLen(0),
+              _clientCertFingerprint(nullptr), _clientKeyFingerprint(nullptr), _brokerCertFingerprint(nullptr),
+              _networkTaskConfig(-1, CONFIG_IOT_CLIENT_NETWORK_TASK_PRIORITY, CONFIG_IOT_CLIENT_NETWORK_TASK_STACK_SIZE),
+              _dispatchTaskConfig(CONFIG_IOT_CLIENT_DISPATCH_TASK_CORE, CONFIG_IOT_CLIENT_DISPATCH_TASK_PRIORITY, CONFIG_IOT_CLIENT_DISPATCH_TASK_STACK_SIZE),
+              _sensorTaskConfig(CONFIG_IOT_CLIENT_SENSOR_TASK_CORE, CONFIG_IOT_CLIENT_SENSOR_TASK_PRIORITY, CONFIG_IOT_CLIENT_SENSOR_TASK_STACK_SIZE),
+              _taskStatsPeriodMs(CONFIG_IOT_CLIENT_TASK_STATS_PERIOD_MS) {}
 
         // Setters
         void SetBrokerUri(const std::string& uri) { _brokerUri = uri; }
@@ -31,6 +46,18 @@ namespace AzureEventGrid
         void SetClientCert(const uint8_t* cert, size_t len) { _clientCert = cert; _clientCertLen = len; }
         void SetClientKey(const uint8_t* key, size_t len) { _clientKey = key; _clientKeyLen = len; }
         void SetBrokerCert(const uint8_t* cert, size_t len) { _brokerCert = cert; _brokerCertLen = len; }
+        // SHA-256 hex fingerprints computed at build time, when not set the client hashes the credentials at startup
+        void SetCredentialFingerprints(const char* clientCert, const char* clientKey, const char* brokerCert)
+        {
+            _clientCertFingerprint = clientCert;
+            _clientKeyFingerprint = clientKey;
+            _brokerCertFingerprint = brokerCert;
+        }
+        // The esp-mqtt network task core is selected by CONFIG_MQTT_USE_CORE_x, only its priority and stack are used here
+        void SetNetworkTaskConfig(const IoTTaskConfig& taskConfig) { _networkTaskConfig = taskConfig; }
+        void SetDispatchTaskConfig(const IoTTaskConfig& taskConfig) { _dispatchTaskConfig = taskConfig; }
+        void SetSensorTaskConfig(const IoTTaskConfig& taskConfig) { _sensorTaskConfig = taskConfig; }
+        void SetTaskStatsPeriodMs(uint32_t periodMs) { _taskStatsPeriodMs = periodMs; }
 
         // Getters
         const char *GetBrokerUri() const { return _brokerUri.c_str(); }
@@ -42,5 +69,12 @@ namespace AzureEventGrid
         size_t GetClientKeyLength() const { return _clientKeyLen; }
         const char* GetBrokerCert() const { return reinterpret_cast<const char*>(_brokerCert); }
         size_t GetBrokerCertLength() const { return _brokerCertLen; }
+        const char* GetClientCertFingerprint() const { return _clientCertFingerprint; }
+        const char* GetClientKeyFingerprint() const { return _clientKeyFingerprint; }
+        const char* GetBrokerCertFingerprint() const { return _brokerCertFingerprint; }
+        const IoTTaskConfig& GetNetworkTaskConfig() const { return _networkTaskConfig; }
+        const IoTTaskConfig& GetDispatchTaskConfig() const { return _dispatchTaskConfig; }
+        const IoTTaskConfig& GetSensorTaskConfig() const { return _sensorTaskConfig; }
+        uint32_t GetTaskStatsPeriodMs() const { return _taskStatsPeriodMs; }
     };
 }
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+
+namespace AzureEventGrid
+{
+    // Placement of a single FreeRTOS task: which core it is pinned to, its priority and its stack size
+    class IoTTaskConfig
+    {
+    private:
+        BaseType_t _core;
+        UBaseType_t _priority;
+        uint32_t _stackSize;
+
+    public:
+        // A negative core means "no affinity"
+        IoTTaskConfig(int core = -1, UBaseType_t priority = 5, uint32_t stackSize = 4096)
+            : _core(core < 0 ? tskNO_AFFINITY : core), _priority(priority), _stackSize(stackSize) {}
+
+        // Setters
+        void SetCore(int core) { _core = core < 0 ? tskNO_AFFINITY : core; }
+        void SetPriority(UBaseType_t priority) { _priority = priority; }
+        void SetStackSize(uint32_t stackSize) { _stackSize = stackSize; }
+
+        // Getters
+        BaseType_t GetCore() const
+        {
+            // Single core parts only have core 0, fall back to no affinity instead of failing the task creation
+            return (_core == tskNO_AFFINITY || _core < portNUM_PROCESSORS) ? _core : tskNO_AFFINITY;
+        }
+        UBaseType_t GetPriority() const { return _priority; }
+        uint32_t GetStackSize() const { return _stackSize; }
+    };
+}
@@ -0,0 +1,291 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string_view>
+#include <array>
+#include <algorithm>
+
+namespace AzureEventGrid
+{
+    // LZSS payload compression with a small sliding window, in the spirit of heatshrink.
+    // Header only and free of ESP-IDF dependencies, so host tools encode and decode the same format.
+    //
+    // Format: the "\0LZ" marker, one byte of window bits << 4 | lookahead bits, the uncompressed length
+    // (4 bytes, little endian), then a bit stream, most significant bit first, of:
+    //   1 + 8 bits                        a literal byte
+    //   0 + window bits + lookahead bits  a back reference: offset - 1 and length - MIN_MATCH
+    // JSON and text never start with a null byte, so plain payloads are told apart by the first byte.
+    class Lzss
+    {
+    public:
+        static constexpr std::string_view MARKER = std::string_view("\0LZ", 3);
+        static constexpr size_t HEADER_SIZE = 8;
+        static constexpr unsigned int MIN_MATCH = 2;  // a 2 byte match is already shorter than two literals
+
+        static bool IsCompressed(std::string_view payload)
+        {
+            return payload.length() >= HEADER_SIZE && payload.compare(0, MARKER.length(), MARKER) == 0;
+        }
+
+        // Decodes any window and lookahead size, the parameters are read from the header.
+        // Returns false on a corrupted stream or when the content is larger than maxLength.
+        template<typename String_t>
+        static bool Decompress(std::string_view payload, String_t& content, size_t maxLength)
+        {
+            if (!IsCompressed(payload))
+            {
+                return false;
+            }
+
+            const unsigned int windowBits = static_cast<uint8_t>(payload[3]) >> 4;
+            const unsigned int lookaheadBits = static_cast<uint8_t>(payload[3]) & 0x0F;
+            size_t length = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                length |= static_cast<size_t>(static_cast<uint8_t>(payload[4 + i])) << (8 * i);
+            }
+            if (windowBits == 0 || lookaheadBits == 0 || length > maxLength)
+            {
+                return false;
+            }
+
+            content.clear();
+            content.reserve(length);
+            BitReader reader(payload.substr(HEADER_SIZE));
+            while (content.length() < length)
+            {
+                uint32_t isLiteral = 0;
+                if (!reader.Read(1, isLiteral))
+                {
+                    return false;
+                }
+
+                if (isLiteral)
+                {
+                    uint32_t literal = 0;
+                    if (!reader.Read(8, literal))
+                    {
+                        return false;
+                    }
+                    content.push_back(static_cast<char>(literal));
+                    continue;
+                }
+
+                uint32_t offset = 0;
+                uint32_t count = 0;
+                if (!reader.Read(windowBits, offset) || !reader.Read(lookaheadBits, count))
+                {
+                    return false;
+                }
+                offset += 1;
+                count += MIN_MATCH;
+                if (offset > content.length() || content.length() + count > length)
+                {
+                    return false;
+                }
+
+                // Byte by byte, the reference may overlap the bytes it produces
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    content.push_back(content[content.length() - offset]);
+                }
+            }
+            return true;
+        }
+
+    protected:
+        template<typename String_t>
+        class BitWriter
+        {
+        public:
+            explicit BitWriter(String_t& output) : _output(output) {}
+
+            void Write(uint32_t value, unsigned int bitCount)
+            {
+                while (bitCount > 0)
+                {
+                    --bitCount;
+                    _byte = static_cast<uint8_t>((_byte << 1) | ((value >> bitCount) & 1));
+                    if (++_bitCount == 8)
+                    {
+                        _output.push_back(static_cast<char>(_byte));
+                        _byte = 0;
+                        _bitCount = 0;
+                    }
+                }
+            }
+
+            // Pads the last byte with zero bits
+            void Flush()
+            {
+                if (_bitCount > 0)
+                {
+                    _output.push_back(static_cast<char>(_byte << (8 - _bitCount)));
+                    _byte = 0;
+                    _bitCount = 0;
+                }
+            }
+
+        private:
+            String_t& _output;
+            uint8_t _byte = 0;
+            unsigned int _bitCount = 0;
+        };
+
+        class BitReader
+        {
+        public:
+            explicit BitReader(std::string_view input) : _input(input) {}
+
+            bool Read(unsigned int bitCount, uint32_t& value)
+            {
+                value = 0;
+                for (; bitCount > 0; --bitCount)
+                {
+                    if (_position >= _input.length() * 8)
+                    {
+                        return false;
+                    }
+                    uint8_t byte = static_cast<uint8_t>(_input[_position / 8]);
+                    value = (value << 1) | ((byte >> (7 - _position % 8)) & 1);
+                    ++_position;
+                }
+                return true;
+            }
+
+        private:
+            std::string_view _input;
+            size_t _position = 0;
+        };
+    };
+
+    // The encoder keeps its match finder tables, (2 ^ WindowBits + 256) * 4 bytes, so compressing does not allocate
+    // beyond the output. Not thread safe, share one instance under a lock.
+    template<unsigned int WindowBits, unsigned int LookaheadBits>
+    class LzssEncoder : public Lzss
+    {
+        static_assert(WindowBits >= 4 && WindowBits <= 15, "Unsupported window size");
+        static_assert(LookaheadBits >= 1 && LookaheadBits <= 8 && LookaheadBits < WindowBits, "Unsupported lookahead size");
+
+    public:
+        static constexpr uint32_t WINDOW_SIZE = 1u << WindowBits;
+        static constexpr uint32_t MAX_MATCH = (1u << LookaheadBits) - 1 + MIN_MATCH;
+
+        // Appends the compressed payload to output. Returns false when it would not be smaller than the content,
+        // the output is then left as it was.
+        template<typename String_t>
+        bool Compress(std::string_view content, String_t& output)
+        {
+            const size_t startLength = output.length();
+            output.reserve(startLength + HEADER_SIZE + content.length());
+            output.append(MARKER.data(), MARKER.length());
+            output.push_back(static_cast<char>((WindowBits << 4) | LookaheadBits));
+            for (int i = 0; i < 4; ++i)
+            {
+                output.push_back(static_cast<char>((content.length() >> (8 * i)) & 0xFF));
+            }
+
+            _head.fill(NONE);
+            BitWriter<String_t> writer(output);
+            const size_t length = content.length();
+            size_t position = 0;
+            while (position < length)
+            {
+                uint32_t bestLength = 0;
+                uint32_t bestOffset = 0;
+                FindLongestMatch(content, position, bestLength, bestOffset);
+
+                if (bestLength >= MIN_MATCH)
+                {
+                    writer.Write(0, 1);
+                    writer.Write(bestOffset - 1, WindowBits);
+                    writer.Write(bestLength - MIN_MATCH, LookaheadBits);
+                    for (uint32_t i = 0; i < bestLength; ++i)
+                    {
+                        Insert(content, position++);
+                    }
+                }
+                else
+                {
+                    writer.Write(1, 1);
+                    writer.Write(static_cast<uint8_t>(content[position]), 8);
+                    Insert(content, position++);
+                }
+
+                // Incompressible content, stop early instead of finishing a longer output
+                if (output.length() - startLength >= HEADER_SIZE + length)
+                {
+                    output.resize(startLength);
+                    return false;
+                }
+            }
+            writer.Flush();
+
+            if (output.length() - startLength >= length)
+            {
+                output.resize(startLength);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        static constexpr uint32_t NONE = UINT32_MAX;
+        static constexpr size_t HASH_SIZE = 256;
+        static constexpr int MAX_CHAIN = 32;  // bounds the search time on repetitive content
+
+        static size_t Hash(std::string_view content, size_t position)
+        {
+            return ((static_cast<uint8_t>(content[position]) * 33u) ^ static_cast<uint8_t>(content[position + 1])) % HASH_SIZE;
+        }
+
+        void Insert(std::string_view content, size_t position)
+        {
+            if (position + 1 < content.length())
+            {
+                size_t hash = Hash(content, position);
+                _previous[position % WINDOW_SIZE] = _head[hash];
+                _head[hash] = static_cast<uint32_t>(position);
+            }
+        }
+
+        void FindLongestMatch(std::string_view content, size_t position, uint32_t& bestLength, uint32_t& bestOffset) const
+        {
+            if (position + MIN_MATCH > content.length())
+            {
+                return;
+            }
+
+            const size_t maxLength = std::min<size_t>(MAX_MATCH, content.length() - position);
+            uint32_t candidate = _head[Hash(content, position)];
+            for (int chain = 0; candidate != NONE && position - candidate <= WINDOW_SIZE && chain < MAX_CHAIN; ++chain)
+            {
+                uint32_t matchLength = 0;
+                while (matchLength < maxLength && content[candidate + matchLength] == content[position + matchLength])
+                {
+                    ++matchLength;
+                }
+                if (matchLength > bestLength)
+                {
+                    bestLength = matchLength;
+                    bestOffset = static_cast<uint32_t>(position - candidate);
+                    if (matchLength == maxLength)
+                    {
+                        break;
+                    }
+                }
+
+                // Chains run towards older positions, a newer one means the slot was reused
+                uint32_t next = _previous[candidate % WINDOW_SIZE];
+                if (next == NONE || next >= candidate)
+                {
+                    break;
+                }
+                candidate = next;
+            }
+        }
+
+        std::array<uint32_t, HASH_SIZE> _head;
+        std::array<uint32_t, WINDOW_SIZE> _previous;
+    };
+}
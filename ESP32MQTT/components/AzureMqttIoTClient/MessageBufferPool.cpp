@@ -0,0 +1,164 @@
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include <stdlib.h>
+#include "MessageBufferPool.h"
+
+static const char *TAG = "MessageBufferPool";
+
+namespace AzureEventGrid
+{
+    namespace
+    {
+        const size_t BLOCK_ALIGNMENT = 8;
+
+        size_t AlignBlockSize(size_t size)
+        {
+            return (size + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+        }
+    }
+
+    /*static*/ MessageBufferPool& MessageBufferPool::GetInstance()
+    {
+        static MessageBufferPool pool;
+        return pool;
+    }
+
+    MessageBufferPool::MessageBufferPool()
+    {
+        _sizeClasses[0] = { AlignBlockSize(CONFIG_IOT_CLIENT_POOL_SMALL_BLOCK_SIZE), CONFIG_IOT_CLIENT_POOL_SMALL_BLOCK_COUNT };
+        _sizeClasses[1] = { AlignBlockSize(CONFIG_IOT_CLIENT_POOL_MEDIUM_BLOCK_SIZE), CONFIG_IOT_CLIENT_POOL_MEDIUM_BLOCK_COUNT };
+        _sizeClasses[2] = { AlignBlockSize(CONFIG_IOT_CLIENT_POOL_LARGE_BLOCK_SIZE), CONFIG_IOT_CLIENT_POOL_LARGE_BLOCK_COUNT };
+
+        for (const auto& sizeClass : _sizeClasses)
+        {
+            _regionSize += sizeClass.blockSize * sizeClass.blockCount;
+        }
+
+#if CONFIG_IOT_CLIENT_POOL_IN_PSRAM
+        _pRegion = static_cast<uint8_t*>(heap_caps_malloc(_regionSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+#else
+        _pRegion = static_cast<uint8_t*>(heap_caps_malloc(_regionSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+#endif
+        if (_pRegion == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to allocate the %u bytes pool region, all buffers come from the heap", (unsigned int)_regionSize);
+            for (auto& sizeClass : _sizeClasses)
+            {
+                sizeClass.blockCount = 0;
+            }
+            _regionSize = 0;
+            return;
+        }
+
+        uint8_t* pBlocks = _pRegion;
+        for (auto& sizeClass : _sizeClasses)
+        {
+            sizeClass.pBlocks = pBlocks;
+            for (size_t i = sizeClass.blockCount; i > 0; --i)
+            {
+                void* pBlock = pBlocks + (i - 1) * sizeClass.blockSize;
+                *static_cast<void**>(pBlock) = sizeClass.pFreeList;
+                sizeClass.pFreeList = pBlock;
+            }
+            pBlocks += sizeClass.blockSize * sizeClass.blockCount;
+        }
+
+        ESP_LOGI(TAG, "Buffer pool of %u bytes created", (unsigned int)_regionSize);
+    }
+
+    void* MessageBufferPool::Allocate(size_t size)
+    {
+        portENTER_CRITICAL(&_lock);
+        // The smallest class that fits, or a larger one when it is exhausted
+        for (auto& sizeClass : _sizeClasses)
+        {
+            if (size <= sizeClass.blockSize && sizeClass.pFreeList != nullptr)
+            {
+                void* pBlock = sizeClass.pFreeList;
+                sizeClass.pFreeList = *static_cast<void**>(pBlock);
+                if (++sizeClass.inUse > sizeClass.peakInUse)
+                {
+                    sizeClass.peakInUse = sizeClass.inUse;
+                }
+                portEXIT_CRITICAL(&_lock);
+                return pBlock;
+            }
+        }
+        ++_fallbackAllocations;
+        ++_fallbackInUse;
+        portEXIT_CRITICAL(&_lock);
+
+        void* pBuffer = malloc(size);
+        if (pBuffer == nullptr)
+        {
+            portENTER_CRITICAL(&_lock);
+            --_fallbackInUse;
+            portEXIT_CRITICAL(&_lock);
+            throw std::bad_alloc();
+        }
+        return pBuffer;
+    }
+
+    void MessageBufferPool::Deallocate(void* pBuffer)
+    {
+        if (pBuffer == nullptr)
+        {
+            return;
+        }
+
+        uint8_t* pByte = static_cast<uint8_t*>(pBuffer);
+        portENTER_CRITICAL(&_lock);
+        if (pByte >= _pRegion && pByte < _pRegion + _regionSize)
+        {
+            for (auto& sizeClass : _sizeClasses)
+            {
+                if (pByte < sizeClass.pBlocks + sizeClass.blockSize * sizeClass.blockCount)
+                {
+                    *static_cast<void**>(pBuffer) = sizeClass.pFreeList;
+                    sizeClass.pFreeList = pBuffer;
+                    --sizeClass.inUse;
+                    break;
+                }
+            }
+            portEXIT_CRITICAL(&_lock);
+            return;
+        }
+        --_fallbackInUse;
+        portEXIT_CRITICAL(&_lock);
+
+        free(pBuffer);
+    }
+
+    MessageBufferPool::Stats MessageBufferPool::GetStats() const
+    {
+        Stats stats;
+        portENTER_CRITICAL(&_lock);
+        for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i)
+        {
+            const auto& sizeClass = _sizeClasses[i];
+            stats.sizeClasses[i] = { sizeClass.blockSize, sizeClass.blockCount, sizeClass.inUse, sizeClass.peakInUse };
+        }
+        stats.fallbackAllocations = _fallbackAllocations;
+        stats.fallbackInUse = _fallbackInUse;
+        portEXIT_CRITICAL(&_lock);
+        return stats;
+    }
+
+    void MessageBufferPool::LogStats() const
+    {
+        Stats stats = GetStats();
+        for (const auto& sizeClass : stats.sizeClasses)
+        {
+            ESP_LOGI(TAG, "Blocks of %4u bytes: %u/%u in use, peak %u", (unsigned int)sizeClass.blockSize, (unsigned int)sizeClass.inUse,
+                (unsigned int)sizeClass.blockCount, (unsigned int)sizeClass.peakInUse);
+        }
+        ESP_LOGI(TAG, "Heap fallbacks: %u in use, %u total", (unsigned int)stats.fallbackInUse, (unsigned int)stats.fallbackAllocations);
+
+        // Fragmentation of the heap the MQTT and TLS buffers are allocated from
+        size_t freeSize = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        size_t largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        ESP_LOGI(TAG, "Internal heap: %u bytes free, largest free block %u bytes, fragmentation %u%%", (unsigned int)freeSize,
+            (unsigned int)largestFreeBlock, freeSize > 0 ? (unsigned int)(100 - (largestFreeBlock * 100) / freeSize) : 0);
+    }
+}
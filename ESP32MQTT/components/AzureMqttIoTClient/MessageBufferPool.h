@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <map>
+#include <array>
+#include <new>
+#include <utility>
+#include "freertos/FreeRTOS.h"
+
+namespace AzureEventGrid
+{
+    // Size classed, fixed block buffer pool for the client I/O paths (topics, payloads, responses, twin values).
+    // All blocks are carved from one region allocated at startup, so long uptimes do not fragment the heap
+    // that the MQTT and TLS buffers are allocated from. Requests that do not fit fall back to the heap and are counted.
+    class MessageBufferPool
+    {
+    public:
+        static const size_t SIZE_CLASS_COUNT = 3;
+
+        struct SizeClassStats
+        {
+            size_t blockSize;
+            size_t blockCount;
+            size_t inUse;
+            size_t peakInUse;
+        };
+
+        struct Stats
+        {
+            std::array<SizeClassStats, SIZE_CLASS_COUNT> sizeClasses;
+            size_t fallbackAllocations;
+            size_t fallbackInUse;
+        };
+
+        static MessageBufferPool& GetInstance();
+
+        void* Allocate(size_t size);
+        void Deallocate(void* pBuffer);
+
+        template<typename T, typename... Args>
+        T* New(Args&&... args)
+        {
+            return new (Allocate(sizeof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        void Delete(T* pObject)
+        {
+            if (pObject != nullptr)
+            {
+                pObject->~T();
+                Deallocate(pObject);
+            }
+        }
+
+        Stats GetStats() const;
+        void LogStats() const;
+
+        MessageBufferPool(const MessageBufferPool&) = delete;
+        MessageBufferPool& operator=(const MessageBufferPool&) = delete;
+
+    private:
+        MessageBufferPool();
+
+        struct SizeClass
+        {
+            size_t blockSize = 0;
+            size_t blockCount = 0;
+            uint8_t* pBlocks = nullptr;
+            void* pFreeList = nullptr;  // the first bytes of a free block link to the next free block
+            size_t inUse = 0;
+            size_t peakInUse = 0;
+        };
+
+        std::array<SizeClass, SIZE_CLASS_COUNT> _sizeClasses;
+        uint8_t* _pRegion = nullptr;
+        size_t _regionSize = 0;
+        size_t _fallbackAllocations = 0;
+        size_t _fallbackInUse = 0;
+        mutable portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+
+    // Stateless allocator that draws from the client buffer pool
+    template<typename T>
+    class PoolAllocator
+    {
+    public:
+        using value_type = T;
+
+        PoolAllocator() noexcept = default;
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+        T* allocate(size_t count)
+        {
+            return static_cast<T*>(MessageBufferPool::GetInstance().Allocate(count * sizeof(T)));
+        }
+
+        void deallocate(T* pBuffer, size_t)
+        {
+            MessageBufferPool::GetInstance().Deallocate(pBuffer);
+        }
+
+        template<typename U>
+        bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+        template<typename U>
+        bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+    };
+
+    using PoolString = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+    using PoolPropertyMap = std::map<PoolString, PoolString, std::less<PoolString>, PoolAllocator<std::pair<const PoolString, PoolString>>>;
+}
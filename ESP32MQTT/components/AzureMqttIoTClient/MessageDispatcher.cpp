@@ -0,0 +1,361 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include "sdkconfig.h"
+#include "LzssCodec.h"
+#include "MessageDispatcher.h"
+
+static const char *TAG = "MessageDispatcher";
+
+namespace AzureEventGrid
+{
+    MessageDispatcher::MessageDispatcher(const DeviceTopics& topics, IMessageDispatcherClient& client, uint32_t twinSyncTimeoutMs) :
+        _topics(topics), _client(client), _twinSyncTimeoutMs(twinSyncTimeoutMs)
+    {
+        _messageHandlers[0] = std::make_unique<CommandHandler>(this);
+        _messageHandlers[1] = std::make_unique<DesiredPropertyHandler>(this);
+        _messageHandlers[2] = std::make_unique<TwinDocumentHandler>(this);
+    }
+
+    bool MessageDispatcher::Dispatch(const Message& message)
+    {
+        for (auto& handler : _messageHandlers)
+        {
+            if (handler->IsResponsibleFor(message.topic))
+            {
+                handler->HandleMessage(message);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void MessageDispatcher::HandleCommand(const Message& message)
+    {
+        std::string_view topic = message.topic;
+        std::string_view payload = message.payload;
+        ESP_LOGI(TAG, "Received command: %.*s with payload: %.*s", (int)topic.length(), topic.data(), (int)payload.length(), payload.data());
+
+        //the command name is the last part of the topic
+        std::string_view commandName = DeviceTopics::GetLastSegment(topic);
+        if (commandName.empty())
+        {
+            ESP_LOGE(TAG, "Invalid command topic: %.*s", (int)topic.length(), topic.data());
+            return;
+        }
+
+        // A redelivered command is not executed again, the cloud probably missed the response, so it is sent again
+        auto key = DeliveryDeduplicator::MakeKey(topic, payload, message.packetId, message.isRedelivery);
+        std::string_view cachedResponse;
+        if (_deliveryDeduplicator.IsDuplicate(key, &cachedResponse))
+        {
+            if (!cachedResponse.empty() && !_client.PublishResponse(commandName, cachedResponse))
+            {
+                ESP_LOGE(TAG, "Failed to send cached command response");
+            }
+            return;
+        }
+
+        std::string result = _client.ExecuteCommand(commandName, payload);
+        PoolString response;
+        if (result.length() > 0)
+        {
+            DeviceTopics::AppendCommandResponse(response, result);
+            if (!_client.PublishResponse(commandName, response))
+            {
+                ESP_LOGE(TAG, "Failed to send command response");
+            }
+        }
+        _deliveryDeduplicator.Remember(key, response);
+    }
+
+    void MessageDispatcher::HandleDesiredProperty(const Message& message)
+    {
+        std::string_view topic = message.topic;
+        std::string_view payload = message.payload;
+        ESP_LOGI(TAG, "Received desired property update: %.*s with payload: %.*s", (int)topic.length(), topic.data(),
+            (int)payload.length(), payload.data());
+
+        //the property name is the last part of the topic
+        std::string_view propertyName = DeviceTopics::GetLastSegment(topic);
+        if (propertyName.empty())
+        {
+            ESP_LOGE(TAG, "Invalid desired property topic: %.*s", (int)topic.length(), topic.data());
+            return;
+        }
+
+        auto key = DeliveryDeduplicator::MakeKey(topic, payload, message.packetId, message.isRedelivery);
+        if (_deliveryDeduplicator.IsDuplicate(key))
+        {
+            return;
+        }
+        _deliveryDeduplicator.Remember(key);
+
+        PoolString decodedPayload;
+        if (!DecodePayload(payload, decodedPayload))
+        {
+            ESP_LOGE(TAG, "Failed to decompress desired property %.*s", (int)propertyName.length(), propertyName.data());
+            return;
+        }
+
+        uint32_t version = 0;
+        PoolString value;
+        bool isVersioned = DeliveryDeduplicator::ParseVersionedValue(payload, version, value);
+        if (isVersioned && _deliveryDeduplicator.IsStaleVersion(propertyName, version))
+        {
+            return;
+        }
+
+        // The retained values are part of the twin document that is on its way, they are notified together
+        std::string_view propertyValue = isVersioned ? std::string_view(value) : payload;
+        if (message.isRetained && IsTwinSyncOutstanding())
+        {
+            DeferDesiredPropertyUpdate(propertyName, propertyValue);
+        }
+        else
+        {
+            OnDesiredPropertyUpdate(propertyName, propertyValue);
+        }
+    }
+
+    void MessageDispatcher::HandleTwinDocument(const Message& message)
+    {
+        std::string_view topic = message.topic;
+        std::string_view payload = message.payload;
+        ESP_LOGI(TAG, "Received twin document: %.*s (%u bytes)", (int)topic.length(), topic.data(), (unsigned int)payload.length());
+
+        //the request id is the last part of the topic
+        std::string_view requestIdText = DeviceTopics::GetLastSegment(topic);
+        uint32_t requestId = 0;
+        auto [end, error] = std::from_chars(requestIdText.data(), requestIdText.data() + requestIdText.length(), requestId);
+        if (error != std::errc() || end != requestIdText.data() + requestIdText.length() || requestIdText.empty())
+        {
+            ESP_LOGE(TAG, "Invalid twin document topic: %.*s", (int)topic.length(), topic.data());
+            return;
+        }
+
+        PoolString decodedPayload;
+        if (!DecodePayload(payload, decodedPayload))
+        {
+            ESP_LOGE(TAG, "Failed to decompress the twin document");
+            return;
+        }
+        ApplyTwinDocument(requestId, payload);
+    }
+
+    void MessageDispatcher::OnDesiredPropertyUpdate(std::string_view propertyName, std::string_view propertyValue)
+    {
+        ESP_LOGI(TAG, "Updating desired property: %.*s = %.*s", (int)propertyName.length(), propertyName.data(),
+            (int)propertyValue.length(), propertyValue.data());
+        DesiredPropertyList_t properties;
+        properties.push_back(StoreDesiredProperty(propertyName, propertyValue));
+        NotifyDesiredProperties(properties);
+    }
+
+    PoolPropertyMap::iterator MessageDispatcher::StoreDesiredProperty(std::string_view propertyName, std::string_view propertyValue)
+    {
+        auto it = _desiredProperties.find(PoolString(propertyName));
+        if (it == _desiredProperties.end())
+        {
+            it = _desiredProperties.emplace(PoolString(propertyName), PoolString(propertyValue)).first;
+        }
+        else
+        {
+            it->second = propertyValue;
+        }
+        _client.OnDesiredPropertyStored(propertyName, propertyValue);
+        return it;
+    }
+
+    void MessageDispatcher::NotifyDesiredProperties(const DesiredPropertyList_t& properties)
+    {
+        if (properties.empty())
+        {
+            return;
+        }
+
+        try
+        {
+            _client.OnDesiredPropertiesChanged(properties);
+        }
+        catch (const std::exception& e)
+        {
+            ESP_LOGE(TAG, "Exception while processing desired property update: %s", e.what());
+        }
+        catch (...)
+        {
+            ESP_LOGE(TAG, "Unknown exception while processing desired property update");
+        }
+    }
+
+    void MessageDispatcher::DeferDesiredPropertyUpdate(std::string_view propertyName, std::string_view propertyValue)
+    {
+        ESP_LOGI(TAG, "Storing retained desired property: %.*s = %.*s, notified with the twin document", (int)propertyName.length(),
+            propertyName.data(), (int)propertyValue.length(), propertyValue.data());
+        auto it = StoreDesiredProperty(propertyName, propertyValue);
+        if (std::find(_deferredDesiredProperties.begin(), _deferredDesiredProperties.end(), it) == _deferredDesiredProperties.end())
+        {
+            _deferredDesiredProperties.push_back(it);
+        }
+    }
+
+    void MessageDispatcher::NotifyDeferredProperties()
+    {
+        DesiredPropertyList_t deferredProperties;
+        deferredProperties.swap(_deferredDesiredProperties);
+        NotifyDesiredProperties(deferredProperties);
+    }
+
+    void MessageDispatcher::BeginTwinSync()
+    {
+        // The desired properties may have changed while disconnected
+        _twinSyncStartTime = esp_timer_get_time();
+        _isTwinSyncPending = true;
+    }
+
+    void MessageDispatcher::RequestTwinDocument()
+    {
+        // Request ids are never 0, which marks no outstanding request
+        uint32_t requestId = ++_lastTwinRequestId;
+        if (requestId == 0)
+        {
+            requestId = ++_lastTwinRequestId;
+        }
+
+        char requestIdText[12];
+        snprintf(requestIdText, sizeof(requestIdText), "%" PRIu32, requestId);
+
+        // Outstanding even when the publish fails, the timeout then notifies the deferred properties
+        _twinRequestId = requestId;
+        _isTwinSyncPending = false;
+        ESP_LOGI(TAG, "Requesting the twin document: %s%s", _topics.GetTwinGetTopic().c_str(), requestIdText);
+        if (!_client.PublishTwinRequest(requestIdText))
+        {
+            ESP_LOGE(TAG, "Failed to request the twin document");
+        }
+    }
+
+    void MessageDispatcher::ApplyTwinDocument(uint32_t requestId, std::string_view document)
+    {
+        // Answers of a previous connection, or redelivered answers, are not applied again
+        if (requestId == 0 || requestId != _twinRequestId)
+        {
+            ESP_LOGW(TAG, "Ignoring the twin document of request %" PRIu32 ", waiting for request %" PRIu32, requestId,
+                (uint32_t)_twinRequestId);
+            return;
+        }
+
+        cJSON* root = cJSON_ParseWithLength(document.data(), document.length());
+        cJSON* versionItem = cJSON_GetObjectItemCaseSensitive(root, "$version");
+        cJSON* desiredItem = cJSON_GetObjectItemCaseSensitive(root, "desired");
+        if (!cJSON_IsNumber(versionItem) || versionItem->valuedouble < 0 || !cJSON_IsObject(desiredItem))
+        {
+            ESP_LOGE(TAG, "Invalid twin document: %.*s", (int)document.length(), document.data());
+            cJSON_Delete(root);
+            return;
+        }
+
+        const uint32_t documentVersion = static_cast<uint32_t>(versionItem->valuedouble);
+        if (documentVersion < _twinDocumentVersion)
+        {
+            ESP_LOGW(TAG, "Ignoring twin document version %" PRIu32 ", version %" PRIu32 " is already applied", documentVersion,
+                _twinDocumentVersion);
+            cJSON_Delete(root);
+
+            // The request is answered, the retained properties received meanwhile are not held back any longer
+            _twinRequestId = 0;
+            NotifyDeferredProperties();
+            return;
+        }
+
+        // Only the properties that differ from the local twin store are notified, together with the deferred retained ones
+        DesiredPropertyList_t changedProperties;
+        changedProperties.swap(_deferredDesiredProperties);
+        size_t propertyCount = 0;
+        cJSON* propertyItem = nullptr;
+        cJSON_ArrayForEach(propertyItem, desiredItem)
+        {
+            ++propertyCount;
+            std::string_view propertyName = propertyItem->string;
+            uint32_t propertyVersion = 0;
+            PoolString propertyValue;
+            bool isVersioned = DeliveryDeduplicator::ParseVersionedValue(propertyItem, propertyVersion, propertyValue);
+            if (!isVersioned)
+            {
+                DeliveryDeduplicator::GetPlainValue(propertyItem, propertyValue);
+            }
+
+            auto it = _desiredProperties.find(PoolString(propertyName));
+            if (it != _desiredProperties.end() && it->second == propertyValue)
+            {
+                // Unchanged, but an older incremental update still in flight must not override it
+                if (isVersioned)
+                {
+                    _deliveryDeduplicator.RecordVersion(propertyName, propertyVersion);
+                }
+                continue;
+            }
+
+            // An incremental update may have overtaken the document
+            if (isVersioned && _deliveryDeduplicator.IsStaleVersion(propertyName, propertyVersion))
+            {
+                continue;
+            }
+
+            it = StoreDesiredProperty(propertyName, propertyValue);
+            if (std::find(changedProperties.begin(), changedProperties.end(), it) == changedProperties.end())
+            {
+                changedProperties.push_back(it);
+            }
+        }
+        cJSON_Delete(root);
+
+        _twinDocumentVersion = documentVersion;
+        _twinRequestId = 0;
+        ESP_LOGI(TAG, "Twin document version %" PRIu32 " applied in %" PRIi64 " ms since connected: %u of %u desired properties changed",
+            documentVersion, (esp_timer_get_time() - _twinSyncStartTime) / 1000, (unsigned int)changedProperties.size(),
+            (unsigned int)propertyCount);
+        NotifyDesiredProperties(changedProperties);
+    }
+
+    bool MessageDispatcher::CheckTwinSyncTimeout()
+    {
+        if (!IsTwinSyncOutstanding() || _twinSyncTimeoutMs == 0 ||
+            esp_timer_get_time() - _twinSyncStartTime < static_cast<int64_t>(_twinSyncTimeoutMs) * 1000)
+        {
+            return false;
+        }
+
+        // Carry on with the incremental updates, the retained properties received so far are not held back any longer
+        ESP_LOGW(TAG, "The twin document did not arrive within %" PRIu32 " ms", _twinSyncTimeoutMs);
+        _isTwinSyncPending = false;
+        _twinRequestId = 0;
+        NotifyDeferredProperties();
+        return true;
+    }
+
+#if CONFIG_IOT_CLIENT_COMPRESSION
+    /*static*/ bool MessageDispatcher::DecodePayload(std::string_view& payload, PoolString& buffer)
+    {
+        if (Lzss::IsCompressed(payload))
+        {
+            if (!Lzss::Decompress(payload, buffer, CONFIG_IOT_CLIENT_COMPRESSION_MAX_INBOUND_SIZE))
+            {
+                return false;
+            }
+            payload = buffer;
+        }
+        return true;
+    }
+#else
+    /*static*/ bool MessageDispatcher::DecodePayload(std::string_view& /*payload*/, PoolString& /*buffer*/)
+    {
+        return true;
+    }
+#endif
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include "MessageBufferPool.h"
+#include "DeviceTopics.h"
+#include "DeliveryDeduplicator.h"
+
+namespace AzureEventGrid
+{
+    // Desired properties to notify, the iterators refer to the twin store of the dispatcher
+    using DesiredPropertyList_t = std::vector<PoolPropertyMap::iterator, PoolAllocator<PoolPropertyMap::iterator>>;
+
+    // The side of the device the dispatcher calls: MqttIoTClient on the device, a virtual device in the fleet simulator
+    class IMessageDispatcherClient
+    {
+    public:
+        virtual ~IMessageDispatcherClient() = default;
+
+        // Runs the command, the result is the payload of its response, no response is sent when it is empty
+        virtual std::string ExecuteCommand(std::string_view commandName, std::string_view commandPayload) = 0;
+        virtual bool PublishResponse(std::string_view commandName, std::string_view response) = 0;
+        // Publishes the twin request on twin/get/<requestId>
+        virtual bool PublishTwinRequest(std::string_view requestId) = 0;
+        // Called for each value stored in the twin store, also for the values whose notification is deferred
+        virtual void OnDesiredPropertyStored(std::string_view /*propertyName*/, std::string_view /*propertyValue*/) {}
+        virtual void OnDesiredPropertiesChanged(const DesiredPropertyList_t& properties) = 0;
+    };
+
+    // Handles the inbound commands, desired properties and twin documents of a device, free of ESP-IDF dependencies
+    // beyond the host shims, so the fleet simulator runs the same code as the device:
+    //   - commands are executed once, a redelivered command is answered with the cached response (DeliveryDeduplicator)
+    //   - desired properties are stored in the twin store, stale versions and redeliveries are dropped
+    //   - twin resynchronization: BeginTwinSync when connected, RequestTwinDocument once subscribed, then the document
+    //     is diffed against the twin store. Meanwhile the retained desired properties are stored, their notification is deferred.
+    // Not thread safe, the device client calls it from its dispatch task only. IsTwinSyncOutstanding may be polled from
+    // another task.
+    class MessageDispatcher
+    {
+    public:
+        struct Message
+        {
+            std::string_view topic;
+            std::string_view payload;
+            uint16_t packetId;
+            bool isRedelivery;
+            bool isRetained;
+        };
+
+        // A twin sync timeout of 0 waits for the document forever
+        MessageDispatcher(const DeviceTopics& topics, IMessageDispatcherClient& client, uint32_t twinSyncTimeoutMs);
+
+        MessageDispatcher(const MessageDispatcher&) = delete;
+        MessageDispatcher& operator=(const MessageDispatcher&) = delete;
+
+        // Returns false when the topic is neither a command, a desired property nor a twin document
+        bool Dispatch(const Message& message);
+
+        void BeginTwinSync();
+        void RequestTwinDocument();
+        bool IsTwinSyncPending() const { return _isTwinSyncPending; }
+        bool IsTwinSyncOutstanding() const { return _isTwinSyncPending || _twinRequestId != 0; }
+        // Notifies the deferred properties when the document is late, returns true when the sync timed out
+        bool CheckTwinSyncTimeout();
+
+        PoolPropertyMap::iterator StoreDesiredProperty(std::string_view propertyName, std::string_view propertyValue);
+        void NotifyDesiredProperties(const DesiredPropertyList_t& properties);
+        const PoolPropertyMap& GetDesiredProperties() const { return _desiredProperties; }
+
+        size_t GetSuppressedCount() const { return _deliveryDeduplicator.GetSuppressedCount(); }
+
+    private:
+        void HandleCommand(const Message& message);
+        void HandleDesiredProperty(const Message& message);
+        void HandleTwinDocument(const Message& message);
+        void OnDesiredPropertyUpdate(std::string_view propertyName, std::string_view propertyValue);
+        void DeferDesiredPropertyUpdate(std::string_view propertyName, std::string_view propertyValue);
+        void ApplyTwinDocument(uint32_t requestId, std::string_view document);
+        void NotifyDeferredProperties();
+        static bool DecodePayload(std::string_view& payload, PoolString& buffer);
+
+        class MessageHandler
+        {
+        protected:
+            MessageDispatcher& _dispatcher;
+
+        public:
+            MessageHandler(MessageDispatcher* pDispatcher) : _dispatcher(*pDispatcher) {}
+            virtual ~MessageHandler() = default;
+
+            virtual const std::string& GetTopicPrefix() const = 0;
+
+            virtual bool IsResponsibleFor(std::string_view topic) const
+            {
+                return topic.compare(0, GetTopicPrefix().length(), GetTopicPrefix()) == 0;
+            }
+
+            virtual void HandleMessage(const Message& message) = 0;
+        };
+
+        class CommandHandler : public MessageHandler
+        {
+        public:
+            using MessageHandler::MessageHandler;
+            const std::string& GetTopicPrefix() const override { return _dispatcher._topics.GetCommandsTopic(); }
+            void HandleMessage(const Message& message) override { _dispatcher.HandleCommand(message); }
+        };
+
+        class DesiredPropertyHandler : public MessageHandler
+        {
+        public:
+            using MessageHandler::MessageHandler;
+            const std::string& GetTopicPrefix() const override { return _dispatcher._topics.GetDesiredPropertyTopic(); }
+            void HandleMessage(const Message& message) override { _dispatcher.HandleDesiredProperty(message); }
+        };
+
+        class TwinDocumentHandler : public MessageHandler
+        {
+        public:
+            using MessageHandler::MessageHandler;
+            const std::string& GetTopicPrefix() const override { return _dispatcher._topics.GetTwinDocumentTopic(); }
+            void HandleMessage(const Message& message) override { _dispatcher.HandleTwinDocument(message); }
+        };
+
+        const DeviceTopics& _topics;
+        IMessageDispatcherClient& _client;
+        const uint32_t _twinSyncTimeoutMs;
+        std::array<std::unique_ptr<MessageHandler>, 3> _messageHandlers;
+
+        DeliveryDeduplicator _deliveryDeduplicator;
+        PoolPropertyMap _desiredProperties;
+
+        // Written by the dispatch task, the device client waits for the twin sync from another task before going to sleep
+        volatile bool _isTwinSyncPending {};
+        volatile uint32_t _twinRequestId {};    // the request waiting for its document, 0 when none
+        uint32_t _lastTwinRequestId {};
+        int64_t _twinSyncStartTime {};
+        uint32_t _twinDocumentVersion {};
+        DesiredPropertyList_t _deferredDesiredProperties;
+    };
+}
@@ -0,0 +1,72 @@
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "OtaPartitionWriter.h"
+
+static const char *TAG = "OtaPartitionWriter";
+
+namespace AzureEventGrid
+{
+    esp_err_t OtaPartitionWriter::Begin(size_t imageSize)
+    {
+        Abort();
+
+#if !CONFIG_SECURE_SIGNED_ON_UPDATE && !CONFIG_IOT_CLIENT_OTA_ALLOW_UNSIGNED_IMAGES
+        // Without signed app verification esp_ota_end only checks the image integrity
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+
+        _pPartition = esp_ota_get_next_update_partition(nullptr);
+        if (_pPartition == nullptr)
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (imageSize > _pPartition->size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        // Sequential writes erase the flash sector by sector instead of erasing the whole partition up front
+        esp_err_t result = esp_ota_begin(_pPartition, OTA_WITH_SEQUENTIAL_WRITES, &_otaHandle);
+        _isWriting = result == ESP_OK;
+        return result;
+    }
+
+    esp_err_t OtaPartitionWriter::Write(const void* data, size_t length)
+    {
+        return esp_ota_write(_otaHandle, data, length);
+    }
+
+    esp_err_t OtaPartitionWriter::Activate()
+    {
+        _isWriting = false;
+        esp_err_t result = esp_ota_end(_otaHandle);
+        if (result == ESP_OK)
+        {
+            result = esp_ota_set_boot_partition(_pPartition);
+        }
+        return result;
+    }
+
+    void OtaPartitionWriter::Abort()
+    {
+        if (_isWriting)
+        {
+            esp_ota_abort(_otaHandle);
+            _isWriting = false;
+        }
+    }
+
+    const char* OtaPartitionWriter::GetName() const
+    {
+        return _pPartition != nullptr ? _pPartition->label : "none";
+    }
+
+    /*static*/ void OtaPartitionWriter::MarkRunningImageValid()
+    {
+        esp_err_t result = esp_ota_mark_app_valid_cancel_rollback();
+        if (result != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Failed to mark the running image as valid: %s", esp_err_to_name(result));
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "IFirmwareWriter.h"
+#include "esp_ota_ops.h"
+
+namespace AzureEventGrid
+{
+    // Writes the firmware image into the next OTA partition with esp_ota
+    class OtaPartitionWriter : public IFirmwareWriter
+    {
+    public:
+        OtaPartitionWriter() = default;
+
+        OtaPartitionWriter(const OtaPartitionWriter&) = delete;
+        OtaPartitionWriter& operator=(const OtaPartitionWriter&) = delete;
+
+        esp_err_t Begin(size_t imageSize) override;
+        esp_err_t Write(const void* data, size_t length) override;
+        esp_err_t Activate() override;
+        void Abort() override;
+        const char* GetName() const override;
+
+        // Confirm the running image after it managed to connect, cancels the bootloader rollback
+        static void MarkRunningImageValid();
+
+    private:
+        const esp_partition_t* _pPartition = nullptr;
+        esp_ota_handle_t _otaHandle = 0;
+        bool _isWriting = false;
+    };
+}
@@ -0,0 +1,289 @@
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "cJSON.h"
+#include <string.h>
+#include <charconv>
+#include "OtaUpdater.h"
+
+static const char *TAG = "OtaUpdater";
+
+namespace AzureEventGrid
+{
+    namespace
+    {
+        bool ParseSha256(const char* hex, uint8_t (&digest)[32])
+        {
+            if (hex == nullptr || strlen(hex) != 64)
+            {
+                return false;
+            }
+
+            for (int i = 0; i < 32; i++)
+            {
+                char byteText[3] = { hex[i * 2], hex[i * 2 + 1], '\0' };
+                char* end = nullptr;
+                digest[i] = static_cast<uint8_t>(strtoul(byteText, &end, 16));
+                if (end != byteText + 2)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    OtaUpdater::OtaUpdater(IFirmwareWriter& writer, ProgressReporter_t progressReporter) : _writer(writer), _progressReporter(progressReporter)
+    {
+        mbedtls_sha256_init(&_sha256Context);
+    }
+
+    OtaUpdater::~OtaUpdater()
+    {
+        if (_state == State::Downloading)
+        {
+            _writer.Abort();
+        }
+        mbedtls_sha256_free(&_sha256Context);
+    }
+
+    void OtaUpdater::HandleMessage(std::string_view subTopic, const char* data, size_t length, size_t fragmentOffset, size_t totalLength)
+    {
+        static const std::string_view chunkPrefix = "chunk/";
+
+        if (subTopic.compare(0, chunkPrefix.length(), chunkPrefix) == 0)
+        {
+            size_t chunkOffset = 0;
+            const char* first = subTopic.data() + chunkPrefix.length();
+            const char* last = subTopic.data() + subTopic.length();
+            auto [end, error] = std::from_chars(first, last, chunkOffset);
+            if (error != std::errc() || end != last || first == last)
+            {
+                ESP_LOGE(TAG, "Invalid OTA chunk topic: %.*s", (int)subTopic.length(), subTopic.data());
+                return;
+            }
+            WriteChunk(chunkOffset + fragmentOffset, data, length, fragmentOffset == 0);
+            return;
+        }
+
+        // Control messages are small, ignore anything that esp-mqtt had to split
+        if (fragmentOffset != 0 || length != totalLength)
+        {
+            ESP_LOGE(TAG, "OTA control message %.*s is too large", (int)subTopic.length(), subTopic.data());
+            return;
+        }
+
+        if (subTopic == "begin")
+        {
+            Begin(data, length);
+        }
+        else if (subTopic == "abort")
+        {
+            Abort("Aborted by the cloud");
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Unknown OTA message: %.*s", (int)subTopic.length(), subTopic.data());
+        }
+    }
+
+    bool OtaUpdater::Begin(const char* data, size_t length)
+    {
+        cJSON* root = cJSON_ParseWithLength(data, length);
+        if (root == nullptr)
+        {
+            ESP_LOGE(TAG, "Failed to parse OTA begin message");
+            return false;
+        }
+
+        cJSON* size = cJSON_GetObjectItemCaseSensitive(root, "size");
+        cJSON* sha256 = cJSON_GetObjectItemCaseSensitive(root, "sha256");
+        uint8_t expectedSha256[32];
+        bool isValid = cJSON_IsNumber(size) && size->valuedouble > 0 && cJSON_IsString(sha256) && ParseSha256(sha256->valuestring, expectedSha256);
+        size_t imageSize = isValid ? static_cast<size_t>(size->valuedouble) : 0;
+        cJSON_Delete(root);
+
+        if (!isValid)
+        {
+            ESP_LOGE(TAG, "OTA begin message must contain the image size and its SHA-256");
+            return false;
+        }
+
+        // The same image announced again (e.g. after a reconnect): continue from the current offset
+        if (_state == State::Downloading && imageSize == _imageSize && memcmp(expectedSha256, _expectedSha256, sizeof(_expectedSha256)) == 0)
+        {
+            ESP_LOGI(TAG, "Resuming OTA update at offset %u of %u", (unsigned int)_offset, (unsigned int)_imageSize);
+            ReportProgress();
+            return true;
+        }
+
+        if (_state == State::Downloading)
+        {
+            ESP_LOGW(TAG, "A new OTA image replaces the one being downloaded");
+            _writer.Abort();
+        }
+
+        esp_err_t result = _writer.Begin(imageSize);
+        if (result != ESP_OK)
+        {
+            _state = State::Failed;
+            _error = result == ESP_ERR_NOT_FOUND ? PoolString("No OTA partition") : result == ESP_ERR_INVALID_SIZE ? 
+                PoolString("Image is larger than the OTA partition") : result == ESP_ERR_NOT_SUPPORTED ? 
+                PoolString("Signed app verification is not enabled") : PoolString("OTA begin failed: ") + esp_err_to_name(result);
+            ESP_LOGE(TAG, "%s", _error.c_str());
+            ReportProgress();
+            return false;
+        }
+
+        memcpy(_expectedSha256, expectedSha256, sizeof(_expectedSha256));
+        mbedtls_sha256_starts(&_sha256Context, 0);
+        _imageSize = imageSize;
+        _offset = 0;
+        _lastReportedOffset = 0;
+        _error.clear();
+        _state = State::Downloading;
+
+        ESP_LOGI(TAG, "OTA update started: %u bytes into partition %s", (unsigned int)_imageSize, _writer.GetName());
+        ReportProgress();
+        return true;
+    }
+
+    void OtaUpdater::WriteChunk(size_t offset, const char* data, size_t length, bool isFirstFragment)
+    {
+        if (_state != State::Downloading)
+        {
+            ESP_LOGW(TAG, "OTA chunk received while no update is in progress");
+            return;
+        }
+
+        // Redelivered data that was already written
+        if (offset + length <= _offset)
+        {
+            ESP_LOGD(TAG, "Skipping duplicate OTA chunk at offset %u", (unsigned int)offset);
+            return;
+        }
+
+        // A missing chunk: ask the sender to restart from the current offset, once for all the fragments of the chunk
+        if (offset > _offset)
+        {
+            if (isFirstFragment)
+            {
+                ESP_LOGW(TAG, "OTA chunk at offset %u, expected %u", (unsigned int)offset, (unsigned int)_offset);
+                ReportProgress();
+            }
+            return;
+        }
+
+        // Partially redelivered chunk, skip the part already written
+        size_t skip = _offset - offset;
+        data += skip;
+        length -= skip;
+
+        if (_offset + length > _imageSize)
+        {
+            Abort("Image data exceeds the announced size");
+            return;
+        }
+
+        esp_err_t result = _writer.Write(data, length);
+        if (result != ESP_OK)
+        {
+            Abort(PoolString("OTA write failed: ") + esp_err_to_name(result));
+            return;
+        }
+
+        mbedtls_sha256_update(&_sha256Context, reinterpret_cast<const unsigned char*>(data), length);
+        _offset += length;
+
+        if (_offset == _imageSize)
+        {
+            Finish();
+        }
+        else if (_offset - _lastReportedOffset >= CONFIG_IOT_CLIENT_OTA_PROGRESS_STEP)
+        {
+            ReportProgress();
+        }
+    }
+
+    void OtaUpdater::Finish()
+    {
+        uint8_t sha256[32];
+        mbedtls_sha256_finish(&_sha256Context, sha256);
+        if (memcmp(sha256, _expectedSha256, sizeof(sha256)) != 0)
+        {
+            Abort("SHA-256 mismatch");
+            return;
+        }
+
+        esp_err_t result = _writer.Activate();
+        if (result != ESP_OK)
+        {
+            _state = State::Failed;
+            _error = PoolString("Image activation failed: ") + esp_err_to_name(result);
+            ESP_LOGE(TAG, "%s", _error.c_str());
+            ReportProgress();
+            return;
+        }
+
+        _state = State::Rebooting;
+        ESP_LOGI(TAG, "OTA image verified, rebooting into partition %s", _writer.GetName());
+        ReportProgress();
+
+        // Give the network task time to deliver the progress report before restarting
+        esp_timer_handle_t restartTimer = nullptr;
+        esp_timer_create_args_t restartTimerArgs = {};
+        restartTimerArgs.callback = [](void*) { esp_restart(); };
+        restartTimerArgs.name = "ota_restart";
+        if (esp_timer_create(&restartTimerArgs, &restartTimer) != ESP_OK || esp_timer_start_once(restartTimer, 2000 * 1000) != ESP_OK)
+        {
+            esp_restart();
+        }
+    }
+
+    void OtaUpdater::Abort(std::string_view reason)
+    {
+        if (_state == State::Downloading)
+        {
+            _writer.Abort();
+        }
+
+        _state = State::Failed;
+        _error = reason;
+        ESP_LOGE(TAG, "OTA update failed: %.*s", (int)reason.length(), reason.data());
+        ReportProgress();
+    }
+
+    void OtaUpdater::ReportProgress()
+    {
+        _lastReportedOffset = _offset;
+        if (!_progressReporter)
+        {
+            return;
+        }
+
+        char numbers[48];
+        snprintf(numbers, sizeof(numbers), "\",\"offset\":%u,\"size\":%u", (unsigned int)_offset, (unsigned int)_imageSize);
+
+        PoolString progress;
+        progress.append("{\"state\":\"").append(GetStateName(_state)).append(numbers);
+        if (!_error.empty())
+        {
+            progress.append(",\"error\":\"").append(_error).append("\"");
+        }
+        progress.append("}");
+        _progressReporter(progress);
+    }
+
+    /*static*/ const char* OtaUpdater::GetStateName(State state)
+    {
+        switch (state)
+        {
+            case State::Idle: return "idle";
+            case State::Downloading: return "downloading";
+            case State::Rebooting: return "rebooting";
+            case State::Failed: return "failed";
+        }
+        return "unknown";
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <functional>
+#include "MessageBufferPool.h"
+#include "IFirmwareWriter.h"
+#include <mbedtls/sha256.h>
+
+namespace AzureEventGrid
+{
+    // Streams a firmware image received in MQTT chunks into a firmware writer (the next OTA partition on the device).
+    // Topics (relative to device/<id>/ota/):
+    //   begin          {"size": <image size>, "sha256": "<hex digest>"}
+    //   chunk/<offset> raw image bytes starting at <offset>
+    //   abort
+    // Progress is reported as JSON: {"state": "...", "offset": <next expected offset>, "size": <image size>}
+    // The sender resumes from the reported offset after a disconnect.
+    class OtaUpdater
+    {
+    public:
+        using ProgressReporter_t = std::function<void(std::string_view progress)>;
+
+        OtaUpdater(IFirmwareWriter& writer, ProgressReporter_t progressReporter);
+        ~OtaUpdater();
+
+        OtaUpdater(const OtaUpdater&) = delete;
+        OtaUpdater& operator=(const OtaUpdater&) = delete;
+
+        // Handle one MQTT message fragment, large chunks are delivered by esp-mqtt in several fragments
+        void HandleMessage(std::string_view subTopic, const char* data, size_t length, size_t fragmentOffset, size_t totalLength);
+
+        bool IsInProgress() const { return _state == State::Downloading; }
+        void ReportProgress();
+
+    private:
+        enum class State { Idle, Downloading, Rebooting, Failed };
+
+        bool Begin(const char* data, size_t length);
+        void WriteChunk(size_t offset, const char* data, size_t length, bool isFirstFragment);
+        void Finish();
+        void Abort(std::string_view reason);
+        static const char* GetStateName(State state);
+
+        IFirmwareWriter& _writer;
+        ProgressReporter_t _progressReporter;
+        State _state = State::Idle;
+        PoolString _error;
+        mbedtls_sha256_context _sha256Context;
+        uint8_t _expectedSha256[32] = {};
+        size_t _imageSize = 0;
+        size_t _offset = 0;
+        size_t _lastReportedOffset = 0;
+    };
+}
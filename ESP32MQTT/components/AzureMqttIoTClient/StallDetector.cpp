@@ -0,0 +1,175 @@
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <stdio.h>
+#include "StallDetector.h"
+
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+
+static const char *TAG = "StallDetector";
+
+namespace AzureEventGrid
+{
+    namespace
+    {
+        const uint32_t TRACE_RING_MAGIC = 0x45434152; // "RACE"
+
+        struct TraceRing
+        {
+            uint32_t magic;
+            uint32_t next;
+            uint32_t count;
+            StallDetector::Trace_t records;
+        };
+
+        // Not initialized at boot, so the trace that led to a watchdog reset or panic is still there after it
+        RTC_NOINIT_ATTR TraceRing g_traceRing;
+
+        const char* GetResetReasonName(esp_reset_reason_t resetReason)
+        {
+            switch (resetReason)
+            {
+                case ESP_RST_TASK_WDT: return "task_wdt";
+                case ESP_RST_INT_WDT: return "int_wdt";
+                case ESP_RST_WDT: return "wdt";
+                case ESP_RST_PANIC: return "panic";
+                default: return nullptr;
+            }
+        }
+    }
+
+    void StallDetector::Begin()
+    {
+        const char* resetReason = GetResetReasonName(esp_reset_reason());
+        if (resetReason != nullptr && g_traceRing.magic == TRACE_RING_MAGIC && g_traceRing.count <= g_traceRing.records.size() && 
+            g_traceRing.next < g_traceRing.records.size())
+        {
+            ESP_LOGW(TAG, "The previous boot ended with %s, reporting its last %u trace entries", resetReason, (unsigned int)g_traceRing.count);
+            TakeSnapshot(resetReason);
+        }
+
+        g_traceRing.magic = TRACE_RING_MAGIC;
+        g_traceRing.next = 0;
+        g_traceRing.count = 0;
+    }
+
+    bool StallDetector::Record(Stage stage, int64_t startTimeUs, int detail)
+    {
+        const int64_t endTimeUs = esp_timer_get_time();
+        const uint32_t durationUs = static_cast<uint32_t>(endTimeUs - startTimeUs);
+        bool isOverrun = durationUs > GetBudgetUs(stage);
+
+        portENTER_CRITICAL(&_lock);
+        TraceRecord& record = g_traceRing.records[g_traceRing.next];
+        record.endTimeUs = static_cast<uint32_t>(endTimeUs);
+        record.durationUs = durationUs;
+        record.detail = static_cast<uint16_t>(detail);
+        record.stage = stage;
+        g_traceRing.next = (g_traceRing.next + 1) % g_traceRing.records.size();
+        if (g_traceRing.count < g_traceRing.records.size())
+        {
+            ++g_traceRing.count;
+        }
+
+        // One report per interval, a slow broker would otherwise flood the diagnostics topic
+        if (isOverrun && (_hasPendingReport || 
+            (_lastReportTimeUs != 0 && endTimeUs - _lastReportTimeUs < CONFIG_IOT_CLIENT_STALL_REPORT_INTERVAL_S * 1000000LL)))
+        {
+            ++_suppressedCount;
+            isOverrun = false;
+        }
+        else if (isOverrun)
+        {
+            _overrunStage = stage;
+            _overrunDurationUs = durationUs;
+            _overrunDetail = record.detail;
+            _lastReportTimeUs = endTimeUs;
+            TakeSnapshot("budget");
+        }
+        portEXIT_CRITICAL(&_lock);
+
+        return isOverrun;
+    }
+
+    void StallDetector::TakeSnapshot(const char* reason)
+    {
+        // Oldest entry first
+        const size_t ringSize = g_traceRing.records.size();
+        const size_t first = (g_traceRing.next + ringSize - g_traceRing.count) % ringSize;
+        for (size_t i = 0; i < g_traceRing.count; ++i)
+        {
+            _snapshot[i] = g_traceRing.records[(first + i) % ringSize];
+        }
+        _snapshotCount = g_traceRing.count;
+        _reason = reason;
+        _hasPendingReport = true;
+    }
+
+    bool StallDetector::TakeReport(PoolString& report)
+    {
+        if (!_hasPendingReport)
+        {
+            return false;
+        }
+
+        char text[160];
+        if (_overrunDurationUs > 0)
+        {
+            snprintf(text, sizeof(text), "{\"reason\":\"%s\",\"stage\":\"%s\",\"durationUs\":%" PRIu32 ",\"budgetUs\":%" PRIu32 
+                ",\"detail\":%u,\"suppressed\":%" PRIu32 ",\"trace\":[", _reason, GetStageName(_overrunStage), _overrunDurationUs, 
+                GetBudgetUs(_overrunStage), _overrunDetail, _suppressedCount);
+        }
+        else
+        {
+            snprintf(text, sizeof(text), "{\"reason\":\"%s\",\"trace\":[", _reason);
+        }
+        report.reserve(strlen(text) + _snapshotCount * 32);
+        report.append(text);
+
+        const uint32_t newestTimeUs = _snapshotCount > 0 ? _snapshot[_snapshotCount - 1].endTimeUs : 0;
+        for (size_t i = 0; i < _snapshotCount; ++i)
+        {
+            const TraceRecord& record = _snapshot[i];
+            snprintf(text, sizeof(text), "%s[%" PRIu32 ",%u,%" PRIu32 ",%u]", i > 0 ? "," : "", newestTimeUs - record.endTimeUs, 
+                static_cast<unsigned int>(record.stage), record.durationUs, record.detail);
+            report.append(text);
+        }
+        report.append("]}");
+
+        portENTER_CRITICAL(&_lock);
+        _overrunDurationUs = 0;
+        _suppressedCount = 0;
+        _hasPendingReport = false;
+        portEXIT_CRITICAL(&_lock);
+        return true;
+    }
+
+    /*static*/ uint32_t StallDetector::GetBudgetUs(Stage stage)
+    {
+        switch (stage)
+        {
+            case Stage::Receive: return CONFIG_IOT_CLIENT_STALL_RECEIVE_BUDGET_MS * 1000;
+            case Stage::QueueWait: return CONFIG_IOT_CLIENT_STALL_QUEUE_WAIT_BUDGET_MS * 1000;
+            case Stage::Dispatch: return CONFIG_IOT_CLIENT_STALL_DISPATCH_BUDGET_MS * 1000;
+            case Stage::Publish: return CONFIG_IOT_CLIENT_STALL_PUBLISH_BUDGET_MS * 1000;
+            case Stage::OtaWrite: return CONFIG_IOT_CLIENT_STALL_OTA_WRITE_BUDGET_MS * 1000;
+        }
+        return UINT32_MAX;
+    }
+
+    /*static*/ const char* StallDetector::GetStageName(Stage stage)
+    {
+        switch (stage)
+        {
+            case Stage::Receive: return "receive";
+            case Stage::QueueWait: return "queue_wait";
+            case Stage::Dispatch: return "dispatch";
+            case Stage::Publish: return "publish";
+            case Stage::OtaWrite: return "ota_write";
+        }
+        return "unknown";
+    }
+}
+
+#endif //CONFIG_IOT_CLIENT_STALL_DETECTOR
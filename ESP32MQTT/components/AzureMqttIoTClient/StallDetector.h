@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "MessageBufferPool.h"
+
+namespace AzureEventGrid
+{
+    // Timestamps the stages of the inbound dispatch and outbound publish paths into a binary trace ring.
+    // A stage that exceeds its latency budget freezes a snapshot of the ring, which is reported as JSON:
+    //   {"reason": "budget", "stage": "dispatch", "durationUs": 523000, "budgetUs": 200000, "detail": 17, "suppressed": 0,
+    //    "trace": [[<age us>, <stage>, <duration us>, <detail>], ...]}   oldest entry first, age relative to the newest
+    // The ring lives in RTC memory that survives a watchdog reset or panic, the trace of the previous boot is then
+    // reported with the reason "task_wdt", "int_wdt", "wdt" or "panic".
+    class StallDetector
+    {
+    public:
+        enum class Stage : uint8_t
+        {
+            Receive = 1,    // network task: MQTT_EVENT_DATA until the message is queued
+            QueueWait = 2,  // dispatch queue: queued until the dispatch task takes the message
+            Dispatch = 3,   // dispatch task: handler and application callback
+            Publish = 4,    // publishing task: esp_mqtt_client_publish, includes the TLS write of QoS 0/1 messages
+            OtaWrite = 5    // network task: MQTT_EVENT_DATA of an OTA chunk, written to flash
+        };
+
+        // Checks whether the previous boot ended with a watchdog reset or panic and starts a new trace
+        void Begin();
+
+        // Records a completed stage, detail is the packet or message id. Returns true when the stage exceeded its budget
+        // and a snapshot is waiting to be reported.
+        bool Record(Stage stage, int64_t startTimeUs, int detail);
+
+        bool HasPendingReport() const { return _hasPendingReport; }
+
+        // Formats the pending snapshot and releases it for the next overrun
+        bool TakeReport(PoolString& report);
+
+        struct TraceRecord
+        {
+            uint32_t endTimeUs;  // lower 32 bits of esp_timer_get_time, ages are computed modulo 2^32
+            uint32_t durationUs;
+            uint16_t detail;
+            Stage stage;
+            uint8_t reserved;
+        };
+
+#if CONFIG_IOT_CLIENT_STALL_DETECTOR
+        using Trace_t = std::array<TraceRecord, CONFIG_IOT_CLIENT_STALL_TRACE_SIZE>;
+#else
+        using Trace_t = std::array<TraceRecord, 1>;
+#endif
+
+    private:
+
+        void TakeSnapshot(const char* reason);
+        static uint32_t GetBudgetUs(Stage stage);
+        static const char* GetStageName(Stage stage);
+
+        Trace_t _snapshot {};
+        size_t _snapshotCount = 0;
+        const char* _reason = nullptr;
+        Stage _overrunStage {};
+        uint32_t _overrunDurationUs = 0;
+        uint16_t _overrunDetail = 0;
+        volatile bool _hasPendingReport = false;
+        int64_t _lastReportTimeUs = 0;
+        uint32_t _suppressedCount = 0;
+        portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    };
+}
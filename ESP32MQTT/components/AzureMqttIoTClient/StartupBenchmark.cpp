@@ -0,0 +1,102 @@
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include "StartupBenchmark.h"
+
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK
+
+static const char *TAG = "StartupBenchmark";
+
+namespace AzureEventGrid
+{
+    void StartupBenchmark::Begin(Phase phase)
+    {
+        if (_isPhaseRunning)
+        {
+            // A connection attempt that failed, its measurement is dropped
+            heap_caps_monitor_local_minimum_free_size_stop();
+        }
+
+        _currentPhase = phase;
+        _isPhaseRunning = true;
+        _phaseStartFreeHeap = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+        heap_caps_monitor_local_minimum_free_size_start();
+        _phaseStartUs = esp_timer_get_time();
+    }
+
+    void StartupBenchmark::End(Phase phase)
+    {
+        if (!IsRunning(phase))
+        {
+            return;
+        }
+
+        int64_t durationUs = esp_timer_get_time() - _phaseStartUs;
+        size_t minimumFreeHeap = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+        heap_caps_monitor_local_minimum_free_size_stop();
+        _isPhaseRunning = false;
+
+        PhaseStats& stats = _phases[static_cast<size_t>(phase)];
+        ++stats.runs;
+        stats.totalUs += durationUs;
+        stats.minUs = durationUs < stats.minUs ? durationUs : stats.minUs;
+        stats.maxUs = durationUs > stats.maxUs ? durationUs : stats.maxUs;
+        size_t peakHeapUse = _phaseStartFreeHeap > minimumFreeHeap ? _phaseStartFreeHeap - minimumFreeHeap : 0;
+        stats.peakHeapUse = peakHeapUse > stats.peakHeapUse ? peakHeapUse : stats.peakHeapUse;
+
+        if (phase == Phase::Subscribe && _readyAfterBootUs == 0)
+        {
+            _readyAfterBootUs = esp_timer_get_time();
+        }
+
+        ESP_LOGI(TAG, "%s: %" PRIi64 " ms, peak heap use %u bytes", GetPhaseName(phase), durationUs / 1000, (unsigned int)peakHeapUse);
+
+        if (phase == Phase::Subscribe && IsComplete() && !_isLogged)
+        {
+            Log();
+            _isLogged = true;
+        }
+    }
+
+    bool StartupBenchmark::IsComplete() const
+    {
+        return _phases[static_cast<size_t>(Phase::Reconnect)].runs >= CONFIG_IOT_CLIENT_STARTUP_BENCHMARK_RECONNECTS;
+    }
+
+    void StartupBenchmark::Log() const
+    {
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK_BASELINE
+        ESP_LOGI(TAG, "Startup benchmark, baseline: PEM credentials, broker chain parsed on each connection");
+#else
+        ESP_LOGI(TAG, "Startup benchmark: DER credentials, broker chain in the global CA store");
+#endif
+        ESP_LOGI(TAG, "phase      runs  min ms  avg ms  max ms  peak heap");
+        for (size_t i = 0; i < _phases.size(); ++i)
+        {
+            const PhaseStats& stats = _phases[i];
+            if (stats.runs == 0)
+            {
+                continue;
+            }
+            ESP_LOGI(TAG, "%-10s %4" PRIu32 " %7" PRIi64 " %7" PRIi64 " %7" PRIi64 " %10u", GetPhaseName(static_cast<Phase>(i)), stats.runs,
+                stats.minUs / 1000, stats.totalUs / stats.runs / 1000, stats.maxUs / 1000, (unsigned int)stats.peakHeapUse);
+        }
+        ESP_LOGI(TAG, "Subscribed %" PRIi64 " ms after boot, minimum free heap since boot: %u bytes", _readyAfterBootUs / 1000,
+            (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    }
+
+    /*static*/ const char* StartupBenchmark::GetPhaseName(Phase phase)
+    {
+        switch (phase)
+        {
+            case Phase::Init: return "init";
+            case Phase::Connect: return "connect";
+            case Phase::Subscribe: return "subscribe";
+            case Phase::Reconnect: return "reconnect";
+            default: return "unknown";
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include "sdkconfig.h"
+
+namespace AzureEventGrid
+{
+    // Measures the time and the peak heap use of the startup phases of the client:
+    //   init       client constructor until the MQTT client is started, the credentials and the CA store are set up here
+    //   connect    first connection attempt until MQTT_EVENT_CONNECTED, includes the TLS handshake
+    //   subscribe  MQTT_EVENT_CONNECTED until all the subscriptions are acknowledged
+    //   reconnect  forced reconnection attempt until MQTT_EVENT_CONNECTED
+    // The peak heap use of a phase is the free heap at its start minus the lowest free heap during it, measured with the
+    // local minimum monitor of the heap. Only one phase runs at a time, a phase begun again before it ended is restarted.
+    // The results are logged once the subscriptions after the last forced reconnection are acknowledged.
+    class StartupBenchmark
+    {
+    public:
+        enum class Phase : uint8_t
+        {
+            Init,
+            Connect,
+            Subscribe,
+            Reconnect,
+            Count
+        };
+
+        void Begin(Phase phase);
+        void End(Phase phase);
+
+        bool IsRunning(Phase phase) const { return _isPhaseRunning && _currentPhase == phase; }
+        bool HasConnected() const { return _phases[static_cast<size_t>(Phase::Connect)].runs > 0; }
+        bool IsComplete() const;
+
+        // Logs one line per phase: runs, min/avg/max time and the largest peak heap use
+        void Log() const;
+
+    private:
+        struct PhaseStats
+        {
+            uint32_t runs = 0;
+            int64_t totalUs = 0;
+            int64_t minUs = INT64_MAX;
+            int64_t maxUs = 0;
+            size_t peakHeapUse = 0;
+        };
+
+        static const char* GetPhaseName(Phase phase);
+
+        std::array<PhaseStats, static_cast<size_t>(Phase::Count)> _phases {};
+        Phase _currentPhase = Phase::Init;
+        bool _isPhaseRunning = false;
+        int64_t _phaseStartUs = 0;
+        size_t _phaseStartFreeHeap = 0;
+        int64_t _readyAfterBootUs = 0;
+        bool _isLogged = false;
+    };
+}
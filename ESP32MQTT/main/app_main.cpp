@@ -24,6 +24,7 @@
 #include "freertos/task.h"
 #include "driver/temperature_sensor.h"
 #include "cJSON.h"
+#include "CredentialFingerprints.h"
 
 using namespace AzureEventGrid;
 
@@ -33,10 +34,19 @@ const gpio_num_t LED_GPIO_PIN = GPIO_NUM_2;
 temperature_sensor_handle_t temperatureSensor = nullptr;
 TaskHandle_t g_mainTaskHandle;
 
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK_BASELINE
+// The startup benchmark baseline connects with the PEM credentials, as they were before the build time conversion
 extern const uint8_t espDeviceCert_pem_start[] asm("_binary_espDeviceCert_pem_start");
 extern const uint8_t espDeviceCert_pem_end[] asm("_binary_espDeviceCert_pem_end");
 extern const uint8_t espDeviceCert_key_start[] asm("_binary_espDeviceCert_key_start");
 extern const uint8_t espDeviceCert_key_end[] asm("_binary_espDeviceCert_key_end");
+#else
+// The device certificate and key are converted to DER at build time
+extern const uint8_t espDeviceCert_der_start[] asm("_binary_espDeviceCert_der_start");
+extern const uint8_t espDeviceCert_der_end[] asm("_binary_espDeviceCert_der_end");
+extern const uint8_t espDeviceKey_der_start[] asm("_binary_espDeviceKey_der_start");
+extern const uint8_t espDeviceKey_der_end[] asm("_binary_espDeviceKey_der_end");
+#endif
 extern const uint8_t brokerCert_pem_start[] asm("_binary_brokerCert_pem_start");
 extern const uint8_t brokerCert_pem_end[] asm("_binary_brokerCert_pem_end");
 
@@ -80,13 +90,14 @@ void ReadTemperature(void *pvParameters)
 }
 
 
-static void DesiredPropertyCallback(IIoTClient *pClient, const std::string& propertyName, const std::string& propertyValue)
+static void DesiredPropertyCallback(IIoTClient *pClient, std::string_view propertyName, std::string_view propertyValue)
 {
-    ESP_LOGI(TAG, "Received desired property update %s=%s", propertyName.c_str(), propertyValue.c_str());
+    ESP_LOGI(TAG, "Received desired property update %.*s=%.*s", (int)propertyName.length(), propertyName.data(), 
+        (int)propertyValue.length(), propertyValue.data());
 
     if (propertyName == "delayBetweenTelemetry")
     {
-        g_delayBetweenTelemetry = std::stoi(propertyValue) * 1000; //convert to milliseconds
+        g_delayBetweenTelemetry = std::stoi(std::string(propertyValue)) * 1000; //convert to milliseconds
         xTaskNotifyGive(g_mainTaskHandle);
     }
 }
@@ -97,16 +108,17 @@ static void SetLight(bool state)
     gpio_set_level(LED_GPIO_PIN, state ? 1 : 0);
 }
 
-static std::string CommandCallback(IIoTClient *pClient, const std::string& commandName, const std::string& payload)
+static std::string CommandCallback(IIoTClient *pClient, std::string_view commandName, std::string_view payload)
 {
-    ESP_LOGI(TAG, "Received command: %s with payload: %s", commandName.c_str(), payload.c_str());
+    ESP_LOGI(TAG, "Received command: %.*s with payload: %.*s", (int)commandName.length(), commandName.data(), 
+        (int)payload.length(), payload.data());
 
-    std::string commandNameLower = commandName;
+    std::string commandNameLower(commandName);
     std::transform(std::begin(commandNameLower), std::end(commandNameLower), std::begin(commandNameLower),
                    [](unsigned char c){ return std::tolower(c); });
 
 
-    cJSON* root = cJSON_ParseWithLength(payload.c_str(), payload.length());
+    cJSON* root = cJSON_ParseWithLength(payload.data(), payload.length());
     if (root == nullptr) 
     {
         ESP_LOGE(TAG, "Failed to parse JSON data");
@@ -155,18 +167,36 @@ static void mqtt_app_start(void)
     IoTClientConfig config;
     config.SetBrokerUri(CONFIG_BROKER_URI);
     config.SetClientId(CONFIG_CLIENT_ID);
+#if CONFIG_IOT_CLIENT_STARTUP_BENCHMARK_BASELINE
+    // Without the fingerprints the client hashes the credentials at boot
     config.SetClientCert(espDeviceCert_pem_start, espDeviceCert_pem_end - espDeviceCert_pem_start);
     config.SetClientKey(espDeviceCert_key_start, espDeviceCert_key_end - espDeviceCert_key_start);
     config.SetBrokerCert(brokerCert_pem_start, brokerCert_pem_end - brokerCert_pem_start);
+#else
+    config.SetClientCert(espDeviceCert_der_start, espDeviceCert_der_end - espDeviceCert_der_start);
+    config.SetClientKey(espDeviceKey_der_start, espDeviceKey_der_end - espDeviceKey_der_start);
+    config.SetBrokerCert(brokerCert_pem_start, brokerCert_pem_end - brokerCert_pem_start);
+    config.SetCredentialFingerprints(CLIENT_CERT_SHA256, CLIENT_KEY_SHA256, BROKER_CERT_SHA256);
+#endif
+
+    //keep the handle to be able to interrupt the delay between telemetry publising when a desired property is received
+    //set before initializing the client, in duty cycled mode the restored desired properties are reported during initialization
+    g_mainTaskHandle = xTaskGetCurrentTaskHandle();
 
     _pAzureMqttIoTClient = IIoTClient::Initialize(config, DesiredPropertyCallback, CommandCallback);
 
     ESP_LOGI(TAG, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
 
-    xTaskCreate(ReadTemperature, "ReadTemperature", 4096, nullptr, 5, nullptr);
+#if CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE
+    // One reading per wake up, the client sends it with the queued telemetry and puts the device to deep sleep
+    float temperature = 0.0;
+    temperature_sensor_get_celsius(temperatureSensor, &temperature);
+    ESP_LOGI("TEMP", "Temperature: %.2f°C", temperature);
+    _pAzureMqttIoTClient->SendTelemetry("temperature", "{\"value\":" + std::to_string(temperature) + "}");
+    _pAzureMqttIoTClient->RunDutyCycle();
+#endif
 
-    //keep the handle to be able to interrupt the delay between telemetry publising when a desired property is received
-    g_mainTaskHandle = xTaskGetCurrentTaskHandle();
+    IIoTClient::CreateTask(config.GetSensorTaskConfig(), ReadTemperature, "ReadTemperature", nullptr);
 
     while (1)
     {
@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+# Converts the first PEM block of the given kind to DER, run at configure time by ESP-IDF's Python.
+#
+#   pem_to_der.py certificate|key <input.pem> <output.der>
+#
+# A PEM block is the base64 encoding of the DER bytes between its BEGIN and END lines. mbedtls parses the DER of
+# PKCS#8, PKCS#1 (RSA) and SEC1 (EC) private keys, so the key is written in the format of the PEM file.
+import base64
+import re
+import sys
+
+LABELS = {
+    'certificate': ('CERTIFICATE',),
+    'key': ('PRIVATE KEY', 'RSA PRIVATE KEY', 'EC PRIVATE KEY'),
+}
+
+PEM_BLOCK = re.compile(r'-----BEGIN ([A-Z0-9 ]+)-----(.*?)-----END \1-----', re.DOTALL)
+
+
+def main():
+    if len(sys.argv) != 4 or sys.argv[1] not in LABELS:
+        sys.exit('usage: pem_to_der.py certificate|key <input.pem> <output.der>')
+    kind, input_path, output_path = sys.argv[1:]
+
+    with open(input_path, 'r') as pem_file:
+        pem = pem_file.read()
+
+    for label, body in PEM_BLOCK.findall(pem):
+        if label == 'ENCRYPTED PRIVATE KEY' or 'Proc-Type:' in body:
+            sys.exit('{}: encrypted keys are not supported'.format(input_path))
+        if label in LABELS[kind]:
+            der = base64.b64decode(''.join(body.split()), validate=True)
+            with open(output_path, 'wb') as der_file:
+                der_file.write(der)
+            return
+
+    sys.exit('{}: no {} found'.format(input_path, kind))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "CloudProbe.h"
+
+namespace FleetSimulator
+{
+    const std::chrono::milliseconds CloudProbe::COMMAND_TICK(10);
+
+    namespace
+    {
+        // Splits device/<clientId>/<kind>/<name> into kind/<name>, empty for foreign topics
+        std::string_view GetDeviceSubTopic(std::string_view topic)
+        {
+            static const std::string_view devicePrefix = "device/";
+            if (topic.compare(0, devicePrefix.length(), devicePrefix) != 0)
+            {
+                return std::string_view();
+            }
+            auto pos = topic.find('/', devicePrefix.length());
+            return pos == std::string_view::npos ? std::string_view() : topic.substr(pos + 1);
+        }
+
+        bool StartsWith(std::string_view text, std::string_view prefix)
+        {
+            return text.compare(0, prefix.length(), prefix) == 0;
+        }
+
+        // Desired property values of the scenario are published as they are written, the twin document needs them as JSON
+        bool IsJsonValue(std::string_view value)
+        {
+            if (value.empty())
+            {
+                return false;
+            }
+            if (value == "true" || value == "false" || value == "null" || value.front() == '{' || value.front() == '[' || value.front() == '"')
+            {
+                return true;
+            }
+            std::string number(value);
+            char* end = nullptr;
+            strtod(number.c_str(), &end);
+            return end == number.c_str() + number.length();
+        }
+    }
+
+    CloudProbe::CloudProbe(EventLoop& eventLoop, const sockaddr_in& brokerAddress, const Scenario& scenario, FleetStats& stats,
+        const std::vector<std::unique_ptr<VirtualDevice>>& devices) :
+        _eventLoop(eventLoop), _scenario(scenario), _stats(stats), _devices(devices),
+        _connection(eventLoop, brokerAddress, scenario.clientIdPrefix + "cloud-probe")
+    {
+        _connection.SetConnectedCallback([this]()
+        {
+            _connection.Subscribe({"device/+/telemetry/#", "device/+/responses/#", "device/+/twin/reported/#", "device/+/twin/get/#"}, 
+                _scenario.qos);
+        });
+        _connection.SetPublishCallback([this](const MqttCodec::Packet& packet) { OnPublish(packet.topic, packet.payload); });
+        _connection.SetClosedCallback([this](const std::string& reason)
+        {
+            if (_isStopped)
+            {
+                return;
+            }
+            // Losing the probe makes every number after that meaningless
+            fprintf(stderr, "Cloud probe disconnected: %s\n", reason.empty() ? "closed" : reason.c_str());
+            _eventLoop.Stop();
+        });
+    }
+
+    void CloudProbe::Start()
+    {
+        _isStopped = false;
+        _connection.Connect();
+        ScheduleCommands();
+    }
+
+    void CloudProbe::Stop()
+    {
+        _isStopped = true;
+        _connection.Disconnect();
+    }
+
+    void CloudProbe::BeginPhase(const Scenario::Phase& phase)
+    {
+        _pPhase = &phase;
+        _commandCredit = 0;
+        _commandWeightTotal = 0;
+        for (const auto& command : phase.commandMix)
+        {
+            _commandWeightTotal += command.weight;
+        }
+
+        _twinVersion += phase.desiredProperties.empty() ? 0 : 1;
+        for (const auto& [name, value] : phase.desiredProperties)
+        {
+            _desiredProperties[name] = value;
+            for (const auto& pDevice : _devices)
+            {
+                if (_connection.Publish(pDevice->GetTopics().GetDesiredPropertyTopic() + name, value, _scenario.qos))
+                {
+                    ++_stats.GetWindow().desiredPropertiesSent;
+                }
+            }
+        }
+    }
+
+    void CloudProbe::OnPublish(std::string_view topic, std::string_view payload)
+    {
+        std::string_view subTopic = GetDeviceSubTopic(topic);
+        auto now = Clock::now();
+
+        if (StartsWith(subTopic, "telemetry/"))
+        {
+            FleetCounters& window = _stats.GetWindow();
+            ++window.telemetryReceived;
+
+            static const std::string_view sentAtKey = "\"sentAt\":";
+            auto pos = payload.find(sentAtKey);
+            if (pos != std::string_view::npos)
+            {
+                // The payload is not null terminated, copy the digits out
+                std::string sentAt(payload.substr(pos + sentAtKey.length(), 20));
+                Clock::time_point sentTime(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(strtoll(sentAt.c_str(), nullptr, 10))));
+                window.telemetryLatency.Add(now - sentTime);
+            }
+        }
+        else if (StartsWith(subTopic, "responses/"))
+        {
+            ++_stats.GetWindow().responsesReceived;
+
+            auto it = _pendingCommands.find(std::string(topic));
+            if (it != _pendingCommands.end() && !it->second.empty())
+            {
+                _stats.GetWindow().commandLatency.Add(now - it->second.front());
+                it->second.pop_front();
+            }
+        }
+        else if (StartsWith(subTopic, "twin/reported/"))
+        {
+            ++_stats.GetWindow().reportedPropertiesReceived;
+        }
+        else if (StartsWith(subTopic, "twin/get/"))
+        {
+            SendTwinDocument(topic, DeviceTopics::GetLastSegment(topic));
+        }
+    }
+
+    void CloudProbe::SendTwinDocument(std::string_view topic, std::string_view requestId)
+    {
+        // device/<clientId>/twin/get/<requestId> is answered on device/<clientId>/twin/document/<requestId>
+        static const std::string_view getSubTopic = "twin/get/";
+        std::string documentTopic(topic.substr(0, topic.length() - requestId.length() - getSubTopic.length()));
+        documentTopic.append("twin/document/").append(requestId);
+
+        std::string document = "{\"$version\":" + std::to_string(_twinVersion) + ",\"desired\":{";
+        for (const auto& [name, value] : _desiredProperties)
+        {
+            document.append(document.back() == '{' ? "\"" : ",\"").append(name).append("\":");
+            document.append(IsJsonValue(value) ? value : "\"" + value + "\"");
+        }
+        document.append("}}");
+
+        if (_connection.Publish(documentTopic, document, _scenario.qos))
+        {
+            ++_stats.GetWindow().twinDocumentsSent;
+        }
+    }
+
+    void CloudProbe::ScheduleCommands()
+    {
+        _eventLoop.ScheduleAfter(COMMAND_TICK, [this]()
+        {
+            if (_isStopped)
+            {
+                return;
+            }
+
+            if (_pPhase != nullptr && _commandWeightTotal > 0 && IsConnected())
+            {
+                _commandCredit += _pPhase->commandRate * std::chrono::duration<double>(COMMAND_TICK).count();
+                for (; _commandCredit >= 1; _commandCredit -= 1)
+                {
+                    SendCommand();
+                }
+            }
+            ScheduleCommands();
+        });
+    }
+
+    void CloudProbe::SendCommand()
+    {
+        // A random connected device, give up after a few tries while the fleet is still ramping up
+        const VirtualDevice* pDevice = nullptr;
+        for (int attempt = 0; attempt < 8 && pDevice == nullptr; ++attempt)
+        {
+            const auto& pCandidate = _devices[_random() % _devices.size()];
+            pDevice = pCandidate->IsConnected() ? pCandidate.get() : nullptr;
+        }
+        if (pDevice == nullptr)
+        {
+            return;
+        }
+
+        unsigned int pick = _random() % _commandWeightTotal;
+        const Scenario::Command* pCommand = &_pPhase->commandMix.front();
+        for (const auto& command : _pPhase->commandMix)
+        {
+            if (pick < command.weight)
+            {
+                pCommand = &command;
+                break;
+            }
+            pick -= command.weight;
+        }
+
+        const std::string& payload = pCommand->payloads[_random() % pCommand->payloads.size()];
+        if (_connection.Publish(pDevice->GetTopics().GetCommandsTopic() + pCommand->name, payload, _scenario.qos))
+        {
+            ++_stats.GetWindow().commandsSent;
+            _pendingCommands[pDevice->GetTopics().GetResponsesTopic() + pCommand->name].push_back(Clock::now());
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "EventLoop.h"
+#include "FleetStats.h"
+#include "MqttConnection.h"
+#include "Scenario.h"
+#include "VirtualDevice.h"
+
+namespace FleetSimulator
+{
+    // Stands in for the cloud side: receives the telemetry, responses and reported properties of the whole fleet,
+    // sends the commands of the current phase and pushes its desired properties. Like the twin responder of the cloud controller,
+    // it answers the twin requests of the devices with the desired properties pushed so far.
+    class CloudProbe
+    {
+    public:
+        CloudProbe(EventLoop& eventLoop, const sockaddr_in& brokerAddress, const Scenario& scenario, FleetStats& stats,
+            const std::vector<std::unique_ptr<VirtualDevice>>& devices);
+
+        void Start();
+        void Stop();
+        bool IsConnected() const { return _connection.IsConnected(); }
+        const MqttConnection& GetConnection() const { return _connection; }
+
+        void BeginPhase(const Scenario::Phase& phase);
+
+    private:
+        void OnPublish(std::string_view topic, std::string_view payload);
+        void SendTwinDocument(std::string_view topic, std::string_view requestId);
+        void ScheduleCommands();
+        void SendCommand();
+
+        static const std::chrono::milliseconds COMMAND_TICK;
+
+        EventLoop& _eventLoop;
+        const Scenario& _scenario;
+        FleetStats& _stats;
+        const std::vector<std::unique_ptr<VirtualDevice>>& _devices;
+        MqttConnection _connection;
+        std::minstd_rand _random;
+        const Scenario::Phase* _pPhase = nullptr;
+        unsigned int _commandWeightTotal = 0;
+        double _commandCredit = 0;  // fractional commands carried over between ticks
+        bool _isStopped = false;
+        // Send times of the commands waiting for a response, keyed by the response topic.
+        // Responses of one device arrive in order, the device client handles its commands one at a time.
+        std::unordered_map<std::string, std::deque<Clock::time_point>> _pendingCommands;
+        // The twin document of every device: the desired properties of the phases so far, the version counts the phases that changed it
+        std::map<std::string, std::string> _desiredProperties;
+        uint32_t _twinVersion = 0;
+    };
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "LzssCodec.h"
+
+// Compression ratio and CPU cost of the device payload compression (LzssCodec.h) on representative payloads.
+// The times are host times; on the device, the client logs its own cost per KB with the task statistics.
+
+using AzureEventGrid::Lzss;
+using AzureEventGrid::LzssEncoder;
+using BenchmarkClock = std::chrono::steady_clock;
+
+namespace
+{
+    struct Payload
+    {
+        const char* name;
+        std::string content;
+    };
+
+    std::vector<Payload> MakePayloads()
+    {
+        std::vector<Payload> payloads;
+        std::mt19937 random(42);
+
+        // What the sample application sends every delayBetweenTelemetry seconds
+        payloads.push_back({"telemetry", "{\"value\":23.450001}"});
+
+        // A day of readings uploaded in one message
+        std::string batch = "[";
+        for (int i = 0; i < 48; ++i)
+        {
+            char reading[96];
+            snprintf(reading, sizeof(reading), "%s{\"value\":%.2f,\"timestamp\":%d}", i > 0 ? "," : "", 21.0 + (random() % 400) / 100.0, 
+                1718000000 + i * 1800);
+            batch += reading;
+        }
+        batch += "]";
+        payloads.push_back({"telemetry batch", batch});
+
+        payloads.push_back({"ota progress", "{\"state\":\"downloading\",\"offset\":1245184,\"size\":1572864}"});
+
+        std::string reported = "{";
+        for (int i = 0; i < 24; ++i)
+        {
+            char property[128];
+            snprintf(property, sizeof(property), "%s\"sensor%02d\":{\"enabled\":true,\"interval\":%d,\"threshold\":%.1f,\"unit\":\"celsius\"}", 
+                i > 0 ? "," : "", i, 60 * (1 + i % 5), 30.0 + i % 7);
+            reported += property;
+        }
+        reported += "}";
+        payloads.push_back({"twin document", reported});
+
+        // Random bytes in base64 like text do not compress, the client then sends the payload as it is
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string opaque = "{\"blob\":\"";
+        for (int i = 0; i < 1024; ++i)
+        {
+            opaque += alphabet[random() % 64];
+        }
+        opaque += "\"}";
+        payloads.push_back({"opaque blob", opaque});
+
+        return payloads;
+    }
+
+    // Repeats the operation until enough time has passed to be measurable, returns the time per call
+    template<typename Operation_t>
+    double MeasureUs(Operation_t operation)
+    {
+        int iterations = 0;
+        auto start = BenchmarkClock::now();
+        auto elapsed = BenchmarkClock::duration::zero();
+        do
+        {
+            operation();
+            ++iterations;
+            elapsed = BenchmarkClock::now() - start;
+        } while (elapsed < std::chrono::milliseconds(50));
+        return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+    }
+
+    template<unsigned int WindowBits, unsigned int LookaheadBits>
+    bool RunConfiguration(const std::vector<Payload>& payloads)
+    {
+        LzssEncoder<WindowBits, LookaheadBits> encoder;
+        bool isValid = true;
+
+        printf("\nwindow %u bits, lookahead %u bits, encoder tables %zu bytes\n", WindowBits, LookaheadBits, sizeof(encoder));
+        printf("%-16s %8s %8s %7s %12s %12s\n", "payload", "bytes", "encoded", "ratio", "comp us/KB", "decomp us/KB");
+
+        for (const auto& payload : payloads)
+        {
+            std::string encoded;
+            bool isCompressed = encoder.Compress(payload.content, encoded);
+            double compressUs = MeasureUs([&]()
+            {
+                std::string output;
+                encoder.Compress(payload.content, output);
+            });
+
+            double decompressUs = 0;
+            if (isCompressed)
+            {
+                std::string decoded;
+                if (!Lzss::Decompress(encoded, decoded, payload.content.length()) || decoded != payload.content)
+                {
+                    printf("%-16s round trip FAILED\n", payload.name);
+                    isValid = false;
+                    continue;
+                }
+                decompressUs = MeasureUs([&]()
+                {
+                    std::string output;
+                    Lzss::Decompress(encoded, output, payload.content.length());
+                });
+            }
+
+            double kilobytes = payload.content.length() / 1024.0;
+            size_t sentLength = isCompressed ? encoded.length() : payload.content.length();
+            printf("%-16s %8zu %8zu %6.1f%% %12.1f %12s\n", payload.name, payload.content.length(), sentLength, 
+                100.0 * sentLength / payload.content.length(), compressUs / kilobytes, 
+                isCompressed ? std::to_string(static_cast<int>(decompressUs / kilobytes + 0.5)).c_str() : "-");
+        }
+        return isValid;
+    }
+}
+
+int main()
+{
+    auto payloads = MakePayloads();
+    bool isValid = RunConfiguration<8, 4>(payloads);
+    isValid = RunConfiguration<10, 4>(payloads) && isValid;
+    isValid = RunConfiguration<12, 5>(payloads) && isValid;
+    return isValid ? 0 : 1;
+}
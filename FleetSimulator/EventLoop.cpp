@@ -0,0 +1,103 @@
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+#include <string>
+#include "EventLoop.h"
+
+namespace FleetSimulator
+{
+    EventLoop::EventLoop() : _epollFd(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (_epollFd < 0)
+        {
+            throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+        }
+    }
+
+    EventLoop::~EventLoop()
+    {
+        close(_epollFd);
+    }
+
+    void EventLoop::Add(int fd, uint32_t events, IoHandler_t handler)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            throw std::runtime_error(std::string("epoll_ctl ADD failed: ") + strerror(errno));
+        }
+        _ioHandlers[fd] = std::move(handler);
+    }
+
+    void EventLoop::Modify(int fd, uint32_t events)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    void EventLoop::Remove(int fd)
+    {
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        _ioHandlers.erase(fd);
+    }
+
+    void EventLoop::ScheduleAt(Clock::time_point when, TimerCallback_t callback)
+    {
+        _timers.push(Timer{when, _timerSequence++, std::move(callback)});
+    }
+
+    void EventLoop::RunDueTimers()
+    {
+        const auto now = Clock::now();
+        while (!_timers.empty() && _timers.top().when <= now && !_isStopped)
+        {
+            // The callback may schedule new timers, take it out of the heap first
+            TimerCallback_t callback = std::move(const_cast<Timer&>(_timers.top()).callback);
+            _timers.pop();
+            callback();
+        }
+    }
+
+    void EventLoop::RunUntil(Clock::time_point until)
+    {
+        static const int MAX_EVENTS = 256;
+        epoll_event events[MAX_EVENTS];
+
+        _isStopped = false;
+        while (!_isStopped && Clock::now() < until)
+        {
+            auto wakeUp = until;
+            if (!_timers.empty() && _timers.top().when < wakeUp)
+            {
+                wakeUp = _timers.top().when;
+            }
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wakeUp - Clock::now()).count();
+            timeout = timeout < 0 ? 0 : timeout;
+
+            int count = epoll_wait(_epollFd, events, MAX_EVENTS, static_cast<int>(timeout));
+            if (count < 0 && errno != EINTR)
+            {
+                throw std::runtime_error(std::string("epoll_wait failed: ") + strerror(errno));
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                // A previous handler of this round may have closed the socket
+                auto it = _ioHandlers.find(events[i].data.fd);
+                if (it != _ioHandlers.end())
+                {
+                    auto handler = it->second;
+                    handler(events[i].events);
+                }
+            }
+
+            RunDueTimers();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace FleetSimulator
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Single threaded reactor: epoll for the sockets and a timer heap, so thousands of devices share one thread
+    class EventLoop
+    {
+    public:
+        using IoHandler_t = std::function<void(uint32_t events)>;
+        using TimerCallback_t = std::function<void()>;
+
+        EventLoop();
+        ~EventLoop();
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        void Add(int fd, uint32_t events, IoHandler_t handler);
+        void Modify(int fd, uint32_t events);
+        void Remove(int fd);
+
+        void ScheduleAt(Clock::time_point when, TimerCallback_t callback);
+        void ScheduleAfter(std::chrono::milliseconds delay, TimerCallback_t callback)
+        {
+            ScheduleAt(Clock::now() + delay, std::move(callback));
+        }
+
+        // Run until the given time or until Stop is called
+        void RunUntil(Clock::time_point until);
+        void Stop() { _isStopped = true; }
+
+    private:
+        struct Timer
+        {
+            Clock::time_point when;
+            uint64_t sequence;  // keeps the timers of the same time in scheduling order
+            TimerCallback_t callback;
+
+            bool operator>(const Timer& other) const
+            {
+                return when != other.when ? when > other.when : sequence > other.sequence;
+            }
+        };
+
+        void RunDueTimers();
+
+        int _epollFd;
+        std::unordered_map<int, IoHandler_t> _ioHandlers;
+        std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+        uint64_t _timerSequence = 0;
+        bool _isStopped = false;
+    };
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <algorithm>
+#include <limits>
+#include "FleetStats.h"
+
+namespace FleetSimulator
+{
+    void LatencySamples::Add(Clock::duration latency)
+    {
+        auto latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        latencyUs = std::max<decltype(latencyUs)>(latencyUs, 0);
+        latencyUs = std::min<decltype(latencyUs)>(latencyUs, std::numeric_limits<uint32_t>::max());
+        _samples.push_back(static_cast<uint32_t>(latencyUs));
+    }
+
+    void LatencySamples::Append(const LatencySamples& other)
+    {
+        _samples.insert(_samples.end(), other._samples.begin(), other._samples.end());
+    }
+
+    double LatencySamples::GetPercentileMs(double percentile) const
+    {
+        if (_samples.empty())
+        {
+            return 0;
+        }
+
+        // nth_element only partially orders the samples, which is all that is needed and cheaper than sorting
+        size_t index = std::min(_samples.size() - 1, static_cast<size_t>(percentile / 100.0 * _samples.size()));
+        std::nth_element(_samples.begin(), _samples.begin() + index, _samples.end());
+        return _samples[index] / 1000.0;
+    }
+
+    std::string LatencySamples::Format() const
+    {
+        if (_samples.empty())
+        {
+            return "-";
+        }
+
+        char text[96];
+        snprintf(text, sizeof(text), "p50 %.2f p95 %.2f p99 %.2f max %.2f ms", GetPercentileMs(50), GetPercentileMs(95), GetPercentileMs(99),
+            GetPercentileMs(100));
+        return text;
+    }
+
+    void FleetCounters::Append(const FleetCounters& other)
+    {
+        telemetrySent += other.telemetrySent;
+        telemetryReceived += other.telemetryReceived;
+        commandsSent += other.commandsSent;
+        responsesReceived += other.responsesReceived;
+        reportedPropertiesReceived += other.reportedPropertiesReceived;
+        desiredPropertiesSent += other.desiredPropertiesSent;
+        twinDocumentsSent += other.twinDocumentsSent;
+        twinSyncTimeouts += other.twinSyncTimeouts;
+        connects += other.connects;
+        disconnects += other.disconnects;
+        bytesSent += other.bytesSent;
+        bytesReceived += other.bytesReceived;
+        telemetryLatency.Append(other.telemetryLatency);
+        commandLatency.Append(other.commandLatency);
+        dutyCycles += other.dutyCycles;
+        telemetryKept += other.telemetryKept;
+        awakeTime.Append(other.awakeTime);
+    }
+
+    void FleetStats::BeginPhase(const std::string& name)
+    {
+        _phaseName = name;
+        _phase = FleetCounters();
+        _phaseStartTime = Clock::now();
+        printf("=== Phase %s\n", name.c_str());
+    }
+
+    void FleetStats::ReportWindow()
+    {
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - _windowStartTime).count();
+        double elapsed = std::chrono::duration<double>(now - _startTime).count();
+
+        printf("[%7.1fs] devices %zu/%zu | telemetry %.1f/s sent %.1f/s recv, %s | commands %.1f/s, rtt %s | %.2f MB/s | "
+            "connects %llu disconnects %llu\n",
+            elapsed, _connectedDevices, _deviceCount, GetRate(_window.telemetrySent, seconds), GetRate(_window.telemetryReceived, seconds),
+            _window.telemetryLatency.Format().c_str(), GetRate(_window.commandsSent, seconds), _window.commandLatency.Format().c_str(),
+            GetRate(_window.bytesSent + _window.bytesReceived, seconds) / (1024 * 1024), (unsigned long long)_window.connects,
+            (unsigned long long)_window.disconnects);
+        fflush(stdout);
+
+        _phase.Append(_window);
+        _window = FleetCounters();
+        _windowStartTime = now;
+    }
+
+    void FleetStats::ReportPhase()
+    {
+        ReportWindow();
+
+        double seconds = std::chrono::duration<double>(Clock::now() - _phaseStartTime).count();
+        uint64_t lostTelemetry = _phase.telemetrySent > _phase.telemetryReceived ? _phase.telemetrySent - _phase.telemetryReceived : 0;
+        uint64_t lostResponses = _phase.commandsSent > _phase.responsesReceived ? _phase.commandsSent - _phase.responsesReceived : 0;
+
+        printf("=== Phase %s summary (%.1f s)\n", _phaseName.c_str(), seconds);
+        printf("    telemetry:  %llu sent, %llu received (%.1f/s), %llu not received\n", (unsigned long long)_phase.telemetrySent,
+            (unsigned long long)_phase.telemetryReceived, GetRate(_phase.telemetryReceived, seconds), (unsigned long long)lostTelemetry);
+        printf("    latency:    %s\n", _phase.telemetryLatency.Format().c_str());
+        printf("    commands:   %llu sent, %llu responses, %llu without response\n", (unsigned long long)_phase.commandsSent,
+            (unsigned long long)_phase.responsesReceived, (unsigned long long)lostResponses);
+        printf("    rtt:        %s\n", _phase.commandLatency.Format().c_str());
+        printf("    properties: %llu desired sent, %llu reported received\n", (unsigned long long)_phase.desiredPropertiesSent,
+            (unsigned long long)_phase.reportedPropertiesReceived);
+        if (_phase.twinDocumentsSent > 0 || _phase.twinSyncTimeouts > 0)
+        {
+            printf("    twin sync:  %llu documents sent, %llu requests timed out\n", (unsigned long long)_phase.twinDocumentsSent,
+                (unsigned long long)_phase.twinSyncTimeouts);
+        }
+        printf("    traffic:    %.2f MB sent, %.2f MB received\n", _phase.bytesSent / (1024.0 * 1024), _phase.bytesReceived / (1024.0 * 1024));
+        printf("    sessions:   %llu connects, %llu disconnects\n", (unsigned long long)_phase.connects, (unsigned long long)_phase.disconnects);
+        if (_phase.dutyCycles > 0)
+        {
+            printf("    duty cycle: %llu cycles, %llu readings kept for the next cycle, awake %s\n", (unsigned long long)_phase.dutyCycles, 
+                (unsigned long long)_phase.telemetryKept, _phase.awakeTime.Format().c_str());
+        }
+        fflush(stdout);
+    }
+}
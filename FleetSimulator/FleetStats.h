@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "EventLoop.h"
+
+namespace FleetSimulator
+{
+    // Latency samples in microseconds, percentiles are computed on demand
+    class LatencySamples
+    {
+    public:
+        void Add(Clock::duration latency);
+        void Append(const LatencySamples& other);
+        void Clear() { _samples.clear(); }
+
+        size_t GetCount() const { return _samples.size(); }
+        // Returns the percentile in milliseconds, 0 without samples
+        double GetPercentileMs(double percentile) const;
+        std::string Format() const;
+
+    private:
+        mutable std::vector<uint32_t> _samples;
+    };
+
+    // Counters of one reporting window or of a whole phase
+    struct FleetCounters
+    {
+        uint64_t telemetrySent = 0;
+        uint64_t telemetryReceived = 0;
+        uint64_t commandsSent = 0;
+        uint64_t responsesReceived = 0;
+        uint64_t reportedPropertiesReceived = 0;
+        uint64_t desiredPropertiesSent = 0;
+        uint64_t twinDocumentsSent = 0;   // answers of the cloud probe to the twin requests of the devices
+        uint64_t twinSyncTimeouts = 0;
+        uint64_t connects = 0;
+        uint64_t disconnects = 0;
+        uint64_t bytesSent = 0;
+        uint64_t bytesReceived = 0;
+        LatencySamples telemetryLatency;  // device publish to cloud delivery
+        LatencySamples commandLatency;    // cloud command to device response
+        uint64_t dutyCycles = 0;
+        uint64_t telemetryKept = 0;       // unacknowledged readings a duty cycled device sends again in its next cycle
+        LatencySamples awakeTime;         // wake up to sleep of a duty cycled device
+
+        void Append(const FleetCounters& other);
+    };
+
+    // Collects the simulator events and prints a line per reporting window and a summary per phase
+    class FleetStats
+    {
+    public:
+        FleetCounters& GetWindow() { return _window; }
+
+        void SetConnectedDevices(size_t connectedDevices, size_t deviceCount)
+        {
+            _connectedDevices = connectedDevices;
+            _deviceCount = deviceCount;
+        }
+
+        void BeginPhase(const std::string& name);
+        void ReportWindow();
+        void ReportPhase();
+
+    private:
+        static double GetRate(uint64_t count, double seconds) { return seconds > 0 ? count / seconds : 0; }
+
+        FleetCounters _window;
+        FleetCounters _phase;
+        std::string _phaseName;
+        Clock::time_point _startTime = Clock::now();
+        Clock::time_point _windowStartTime = _startTime;
+        Clock::time_point _phaseStartTime = _startTime;
+        size_t _connectedDevices = 0;
+        size_t _deviceCount = 0;
+    };
+}
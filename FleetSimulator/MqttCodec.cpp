@@ -0,0 +1,193 @@
+#include <stdexcept>
+#include "MqttCodec.h"
+
+namespace FleetSimulator
+{
+    namespace MqttCodec
+    {
+        namespace
+        {
+            void AppendUint16(std::string& out, uint16_t value)
+            {
+                out.push_back(static_cast<char>(value >> 8));
+                out.push_back(static_cast<char>(value & 0xFF));
+            }
+
+            void AppendString(std::string& out, std::string_view value)
+            {
+                AppendUint16(out, static_cast<uint16_t>(value.length()));
+                out.append(value);
+            }
+
+            void AppendFixedHeader(std::string& out, PacketType type, uint8_t flags, size_t remainingLength)
+            {
+                out.push_back(static_cast<char>((static_cast<uint8_t>(type) << 4) | flags));
+                do
+                {
+                    uint8_t encodedByte = remainingLength % 128;
+                    remainingLength /= 128;
+                    if (remainingLength > 0)
+                    {
+                        encodedByte |= 0x80;
+                    }
+                    out.push_back(static_cast<char>(encodedByte));
+                } while (remainingLength > 0);
+            }
+        }
+
+        void AppendConnect(std::string& out, std::string_view clientId, uint16_t keepAliveS, bool cleanSession)
+        {
+            static const std::string_view protocolName = "MQTT";
+            const uint8_t protocolLevel = 4;
+
+            size_t remainingLength = 2 + protocolName.length() + 1 + 1 + 2 + 2 + clientId.length();
+            AppendFixedHeader(out, PacketType::Connect, 0, remainingLength);
+            AppendString(out, protocolName);
+            out.push_back(static_cast<char>(protocolLevel));
+            out.push_back(static_cast<char>(cleanSession ? 0x02 : 0x00));
+            AppendUint16(out, keepAliveS);
+            AppendString(out, clientId);
+        }
+
+        void AppendSubscribe(std::string& out, uint16_t packetId, const std::vector<std::string>& topicFilters, uint8_t qos)
+        {
+            size_t remainingLength = 2;
+            for (const auto& topicFilter : topicFilters)
+            {
+                remainingLength += 2 + topicFilter.length() + 1;
+            }
+
+            AppendFixedHeader(out, PacketType::Subscribe, 0x02, remainingLength);
+            AppendUint16(out, packetId);
+            for (const auto& topicFilter : topicFilters)
+            {
+                AppendString(out, topicFilter);
+                out.push_back(static_cast<char>(qos));
+            }
+        }
+
+        void AppendPublish(std::string& out, std::string_view topic, std::string_view payload, uint8_t qos, uint16_t packetId, bool retain)
+        {
+            size_t remainingLength = 2 + topic.length() + (qos > 0 ? 2 : 0) + payload.length();
+            AppendFixedHeader(out, PacketType::Publish, static_cast<uint8_t>((qos << 1) | (retain ? 1 : 0)), remainingLength);
+            AppendString(out, topic);
+            if (qos > 0)
+            {
+                AppendUint16(out, packetId);
+            }
+            out.append(payload);
+        }
+
+        void AppendPubAck(std::string& out, uint16_t packetId)
+        {
+            AppendFixedHeader(out, PacketType::PubAck, 0, 2);
+            AppendUint16(out, packetId);
+        }
+
+        void AppendPingReq(std::string& out)
+        {
+            AppendFixedHeader(out, PacketType::PingReq, 0, 0);
+        }
+
+        void AppendDisconnect(std::string& out)
+        {
+            AppendFixedHeader(out, PacketType::Disconnect, 0, 0);
+        }
+    }
+
+    bool MqttDecoder::Next(MqttCodec::Packet& packet)
+    {
+        // Drop the packets handed out by the previous call once they add up, instead of moving the buffer on every packet
+        if (_consumed > 0 && (_consumed == _buffer.length() || _consumed > 64 * 1024))
+        {
+            _buffer.erase(0, _consumed);
+            _consumed = 0;
+        }
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(_buffer.data()) + _consumed;
+        size_t available = _buffer.length() - _consumed;
+        if (available < 2)
+        {
+            return false;
+        }
+
+        size_t remainingLength = 0;
+        size_t headerLength = 1;
+        for (int multiplier = 1;; multiplier *= 128)
+        {
+            if (headerLength >= available)
+            {
+                return false;
+            }
+            if (headerLength > 4)
+            {
+                throw std::runtime_error("Malformed MQTT remaining length");
+            }
+            uint8_t encodedByte = data[headerLength++];
+            remainingLength += (encodedByte & 0x7F) * multiplier;
+            if ((encodedByte & 0x80) == 0)
+            {
+                break;
+            }
+        }
+
+        if (available < headerLength + remainingLength)
+        {
+            return false;
+        }
+
+        const uint8_t* body = data + headerLength;
+        packet = MqttCodec::Packet{};
+        packet.type = static_cast<MqttCodec::PacketType>(data[0] >> 4);
+        packet.flags = data[0] & 0x0F;
+
+        switch (packet.type)
+        {
+            case MqttCodec::PacketType::ConnAck:
+                if (remainingLength < 2)
+                {
+                    throw std::runtime_error("Malformed CONNACK");
+                }
+                packet.returnCode = body[1];
+                break;
+
+            case MqttCodec::PacketType::Publish:
+            {
+                if (remainingLength < 2)
+                {
+                    throw std::runtime_error("Malformed PUBLISH");
+                }
+                size_t topicLength = (body[0] << 8) | body[1];
+                size_t pos = 2 + topicLength;
+                uint8_t qos = (packet.flags >> 1) & 0x03;
+                if (pos + (qos > 0 ? 2 : 0) > remainingLength)
+                {
+                    throw std::runtime_error("Malformed PUBLISH");
+                }
+                packet.topic = std::string_view(reinterpret_cast<const char*>(body + 2), topicLength);
+                if (qos > 0)
+                {
+                    packet.packetId = static_cast<uint16_t>((body[pos] << 8) | body[pos + 1]);
+                    pos += 2;
+                }
+                packet.payload = std::string_view(reinterpret_cast<const char*>(body + pos), remainingLength - pos);
+                break;
+            }
+
+            case MqttCodec::PacketType::PubAck:
+            case MqttCodec::PacketType::SubAck:
+                if (remainingLength < 2)
+                {
+                    throw std::runtime_error("Malformed acknowledgement");
+                }
+                packet.packetId = static_cast<uint16_t>((body[0] << 8) | body[1]);
+                break;
+
+            default:
+                break;
+        }
+
+        _consumed += headerLength + remainingLength;
+        return true;
+    }
+}
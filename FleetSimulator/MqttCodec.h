@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FleetSimulator
+{
+    // Minimal MQTT 3.1.1 packet encoding and decoding, just what the simulated devices and the cloud probe need
+    namespace MqttCodec
+    {
+        enum class PacketType : uint8_t
+        {
+            Connect = 1,
+            ConnAck = 2,
+            Publish = 3,
+            PubAck = 4,
+            Subscribe = 8,
+            SubAck = 9,
+            PingReq = 12,
+            PingResp = 13,
+            Disconnect = 14
+        };
+
+        struct Packet
+        {
+            PacketType type;
+            uint8_t flags;
+            uint16_t packetId;
+            uint8_t returnCode;      // CONNACK
+            std::string_view topic;  // PUBLISH, points into the decoder buffer
+            std::string_view payload;
+        };
+
+        // PUBLISH flags: the broker sets DUP when it sends an unacknowledged message again
+        inline bool IsRedelivery(const Packet& packet) { return (packet.flags & 0x08) != 0; }
+        inline bool IsRetained(const Packet& packet) { return (packet.flags & 0x01) != 0; }
+
+        void AppendConnect(std::string& out, std::string_view clientId, uint16_t keepAliveS, bool cleanSession);
+        void AppendSubscribe(std::string& out, uint16_t packetId, const std::vector<std::string>& topicFilters, uint8_t qos);
+        void AppendPublish(std::string& out, std::string_view topic, std::string_view payload, uint8_t qos, uint16_t packetId, bool retain = false);
+        void AppendPubAck(std::string& out, uint16_t packetId);
+        void AppendPingReq(std::string& out);
+        void AppendDisconnect(std::string& out);
+    }
+
+    // Incremental decoder fed with the bytes read from a socket
+    class MqttDecoder
+    {
+    public:
+        void Append(const char* data, size_t length) { _buffer.append(data, length); }
+
+        // Returns false when no complete packet is buffered. The packet views stay valid until the next call.
+        // Throws std::runtime_error on a malformed stream.
+        bool Next(MqttCodec::Packet& packet);
+
+    private:
+        std::string _buffer;
+        size_t _consumed = 0;
+    };
+}
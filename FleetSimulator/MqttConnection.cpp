@@ -0,0 +1,335 @@
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+#include "MqttConnection.h"
+
+namespace FleetSimulator
+{
+    MqttConnection::MqttConnection(EventLoop& eventLoop, const sockaddr_in& brokerAddress, std::string clientId, uint16_t keepAliveS) :
+        _eventLoop(eventLoop), _brokerAddress(brokerAddress), _clientId(std::move(clientId)), _keepAliveS(keepAliveS)
+    {
+    }
+
+    MqttConnection::~MqttConnection()
+    {
+        if (_fd >= 0)
+        {
+            _eventLoop.Remove(_fd);
+            close(_fd);
+        }
+    }
+
+    void MqttConnection::Connect()
+    {
+        if (_state != State::Disconnected)
+        {
+            return;
+        }
+
+        _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_fd < 0)
+        {
+            Close(std::string("socket failed: ") + strerror(errno));
+            return;
+        }
+
+        int noDelay = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        if (connect(_fd, reinterpret_cast<const sockaddr*>(&_brokerAddress), sizeof(_brokerAddress)) != 0 && errno != EINPROGRESS)
+        {
+            int error = errno;
+            close(_fd);
+            _fd = -1;
+            Close(std::string("connect failed: ") + strerror(error));
+            return;
+        }
+
+        ++_connectionGeneration;
+        _state = State::Connecting;
+        _decoder = MqttDecoder();
+        _output.clear();
+        _outputOffset = 0;
+        _unackedPublishCount = 0;
+        _isWaitingForWritable = true;
+        _eventLoop.Add(_fd, EPOLLIN | EPOLLOUT, [this](uint32_t events) { HandleIo(events); });
+
+        MqttCodec::AppendConnect(_output, _clientId, _keepAliveS, _isCleanSession);
+    }
+
+    void MqttConnection::Disconnect()
+    {
+        if (_state == State::Connected)
+        {
+            MqttCodec::AppendDisconnect(_output);
+            FlushOutput();
+        }
+        Close("");
+    }
+
+    void MqttConnection::Subscribe(const std::vector<std::string>& topicFilters, uint8_t qos)
+    {
+        MqttCodec::AppendSubscribe(_output, NextPacketId(), topicFilters, qos);
+        FlushOutput();
+    }
+
+    bool MqttConnection::Publish(std::string_view topic, std::string_view payload, uint8_t qos, bool retain, uint16_t* pPacketId)
+    {
+        if (_state != State::Connected)
+        {
+            return false;
+        }
+
+        uint16_t packetId = qos > 0 ? NextPacketId() : 0;
+        MqttCodec::AppendPublish(_output, topic, payload, qos, packetId, retain);
+        if (qos > 0)
+        {
+            ++_unackedPublishCount;
+        }
+        if (pPacketId != nullptr)
+        {
+            *pPacketId = packetId;
+        }
+        FlushOutput();
+        return true;
+    }
+
+    void MqttConnection::HandleIo(uint32_t events)
+    {
+        if (events & (EPOLLERR | EPOLLHUP))
+        {
+            int error = 0;
+            socklen_t errorLength = sizeof(error);
+            getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+            Close(error != 0 ? strerror(error) : "Connection closed by the broker");
+            return;
+        }
+
+        if (events & EPOLLOUT)
+        {
+            if (_state == State::Connecting)
+            {
+                _state = State::WaitingForConnAck;
+            }
+            FlushOutput();
+        }
+
+        if ((events & EPOLLIN) && _fd >= 0)
+        {
+            HandleReadable();
+        }
+    }
+
+    void MqttConnection::HandleReadable()
+    {
+        char buffer[16 * 1024];
+        for (;;)
+        {
+            ssize_t length = recv(_fd, buffer, sizeof(buffer), 0);
+            if (length > 0)
+            {
+                _decoder.Append(buffer, static_cast<size_t>(length));
+                _bytesReceived += static_cast<uint64_t>(length);
+                if (static_cast<size_t>(length) < sizeof(buffer))
+                {
+                    break;
+                }
+            }
+            else if (length == 0)
+            {
+                Close("Connection closed by the broker");
+                return;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno != EINTR)
+            {
+                Close(std::string("recv failed: ") + strerror(errno));
+                return;
+            }
+        }
+
+        try
+        {
+            // A callback may close the connection, stop as soon as it happens
+            uint64_t generation = _connectionGeneration;
+            MqttCodec::Packet packet;
+            while (_fd >= 0 && generation == _connectionGeneration && _decoder.Next(packet))
+            {
+                HandlePacket(packet);
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            Close(e.what());
+        }
+    }
+
+    void MqttConnection::HandlePacket(const MqttCodec::Packet& packet)
+    {
+        switch (packet.type)
+        {
+            case MqttCodec::PacketType::ConnAck:
+                if (packet.returnCode != 0)
+                {
+                    Close("Connection refused, return code " + std::to_string(packet.returnCode));
+                    return;
+                }
+                _state = State::Connected;
+                ScheduleKeepAlive();
+                if (_connectedCallback)
+                {
+                    _connectedCallback();
+                }
+                break;
+
+            case MqttCodec::PacketType::Publish:
+            {
+                // Subscriptions are at most QoS 1, the PUBREC/PUBREL/PUBCOMP exchange of QoS 2 is not implemented
+                uint8_t qos = (packet.flags >> 1) & 0x03;
+                if (qos > 1)
+                {
+                    Close("Unexpected QoS " + std::to_string(qos) + " publish on " + std::string(packet.topic));
+                    return;
+                }
+                if (qos == 1)
+                {
+                    MqttCodec::AppendPubAck(_output, packet.packetId);
+                    FlushOutput();
+                }
+                if (_publishCallback)
+                {
+                    _publishCallback(packet);
+                }
+                break;
+            }
+
+            case MqttCodec::PacketType::PubAck:
+                if (_unackedPublishCount > 0)
+                {
+                    --_unackedPublishCount;
+                }
+                if (_pubAckCallback)
+                {
+                    _pubAckCallback(packet.packetId);
+                }
+                break;
+
+            case MqttCodec::PacketType::SubAck:
+                if (_subAckCallback)
+                {
+                    _subAckCallback(packet.packetId);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    void MqttConnection::FlushOutput()
+    {
+        if (_fd < 0 || _state == State::Connecting)
+        {
+            return;
+        }
+
+        while (_outputOffset < _output.length())
+        {
+            ssize_t length = send(_fd, _output.data() + _outputOffset, _output.length() - _outputOffset, MSG_NOSIGNAL);
+            if (length > 0)
+            {
+                _outputOffset += static_cast<size_t>(length);
+                _bytesSent += static_cast<uint64_t>(length);
+                _lastSendTime = Clock::now();
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno != EINTR)
+            {
+                Close(std::string("send failed: ") + strerror(errno));
+                return;
+            }
+        }
+
+        if (_outputOffset == _output.length())
+        {
+            _output.clear();
+            _outputOffset = 0;
+        }
+        UpdateInterest();
+    }
+
+    void MqttConnection::UpdateInterest()
+    {
+        // Only ask for EPOLLOUT while there is a backlog, otherwise every loop iteration would wake up for it
+        bool isWaitingForWritable = GetPendingOutputSize() > 0;
+        if (isWaitingForWritable != _isWaitingForWritable)
+        {
+            _isWaitingForWritable = isWaitingForWritable;
+            _eventLoop.Modify(_fd, isWaitingForWritable ? (EPOLLIN | EPOLLOUT) : static_cast<uint32_t>(EPOLLIN));
+        }
+    }
+
+    void MqttConnection::ScheduleKeepAlive()
+    {
+        if (_keepAliveS == 0)
+        {
+            return;
+        }
+
+        uint64_t generation = _connectionGeneration;
+        auto interval = std::chrono::seconds(_keepAliveS) / 2;
+        _eventLoop.ScheduleAfter(std::chrono::duration_cast<std::chrono::milliseconds>(interval), [this, generation, interval]()
+        {
+            if (generation != _connectionGeneration || _state != State::Connected)
+            {
+                return;
+            }
+            if (Clock::now() - _lastSendTime >= interval)
+            {
+                MqttCodec::AppendPingReq(_output);
+                FlushOutput();
+            }
+            ScheduleKeepAlive();
+        });
+    }
+
+    void MqttConnection::Close(const std::string& reason)
+    {
+        if (_fd >= 0)
+        {
+            _eventLoop.Remove(_fd);
+            close(_fd);
+            _fd = -1;
+        }
+
+        bool wasOpen = _state != State::Disconnected;
+        _state = State::Disconnected;
+        ++_connectionGeneration;
+
+        if ((wasOpen || !reason.empty()) && _closedCallback)
+        {
+            _closedCallback(reason);
+        }
+    }
+
+    uint16_t MqttConnection::NextPacketId()
+    {
+        // Packet id 0 is not allowed
+        if (++_lastPacketId == 0)
+        {
+            _lastPacketId = 1;
+        }
+        return _lastPacketId;
+    }
+}
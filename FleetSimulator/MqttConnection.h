@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <netinet/in.h>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "EventLoop.h"
+#include "MqttCodec.h"
+
+namespace FleetSimulator
+{
+    // Non blocking MQTT 3.1.1 client connection driven by the event loop.
+    // Plain TCP only, the simulator targets a local broker.
+    class MqttConnection
+    {
+    public:
+        using ConnectedCallback_t = std::function<void()>;
+        using PublishCallback_t = std::function<void(const MqttCodec::Packet& packet)>;
+        using ClosedCallback_t = std::function<void(const std::string& reason)>;
+        using PubAckCallback_t = std::function<void(uint16_t packetId)>;
+        using SubAckCallback_t = std::function<void(uint16_t packetId)>;
+
+        MqttConnection(EventLoop& eventLoop, const sockaddr_in& brokerAddress, std::string clientId, uint16_t keepAliveS = 60);
+        ~MqttConnection();
+
+        MqttConnection(const MqttConnection&) = delete;
+        MqttConnection& operator=(const MqttConnection&) = delete;
+
+        void SetConnectedCallback(ConnectedCallback_t callback) { _connectedCallback = std::move(callback); }
+        void SetPublishCallback(PublishCallback_t callback) { _publishCallback = std::move(callback); }
+        void SetClosedCallback(ClosedCallback_t callback) { _closedCallback = std::move(callback); }
+        void SetPubAckCallback(PubAckCallback_t callback) { _pubAckCallback = std::move(callback); }
+        void SetSubAckCallback(SubAckCallback_t callback) { _subAckCallback = std::move(callback); }
+
+        // A persistent session keeps the subscriptions and the QoS 1 messages while the device is disconnected
+        void SetCleanSession(bool isCleanSession) { _isCleanSession = isCleanSession; }
+
+        void Connect();
+        void Disconnect();
+
+        bool IsConnected() const { return _state == State::Connected; }
+        const std::string& GetClientId() const { return _clientId; }
+
+        void Subscribe(const std::vector<std::string>& topicFilters, uint8_t qos);
+        bool Publish(std::string_view topic, std::string_view payload, uint8_t qos, bool retain = false, uint16_t* pPacketId = nullptr);
+
+        // Bytes waiting for the socket, a growing backlog means the broker does not keep up
+        size_t GetPendingOutputSize() const { return _output.length() - _outputOffset; }
+        size_t GetUnackedPublishCount() const { return _unackedPublishCount; }
+        uint64_t GetBytesSent() const { return _bytesSent; }
+        uint64_t GetBytesReceived() const { return _bytesReceived; }
+
+    private:
+        enum class State { Disconnected, Connecting, WaitingForConnAck, Connected };
+
+        void HandleIo(uint32_t events);
+        void HandleReadable();
+        void HandlePacket(const MqttCodec::Packet& packet);
+        void FlushOutput();
+        void UpdateInterest();
+        void ScheduleKeepAlive();
+        void Close(const std::string& reason);
+        uint16_t NextPacketId();
+
+        EventLoop& _eventLoop;
+        sockaddr_in _brokerAddress;
+        std::string _clientId;
+        uint16_t _keepAliveS;
+        bool _isCleanSession = true;
+        int _fd = -1;
+        State _state = State::Disconnected;
+        MqttDecoder _decoder;
+        std::string _output;
+        size_t _outputOffset = 0;
+        bool _isWaitingForWritable = false;
+        uint16_t _lastPacketId = 0;
+        size_t _unackedPublishCount = 0;
+        uint64_t _bytesSent = 0;
+        uint64_t _bytesReceived = 0;
+        Clock::time_point _lastSendTime;
+        // Invalidates the keep alive timers of a previous connection
+        uint64_t _connectionGeneration = 0;
+        ConnectedCallback_t _connectedCallback;
+        PublishCallback_t _publishCallback;
+        ClosedCallback_t _closedCallback;
+        PubAckCallback_t _pubAckCallback;
+        SubAckCallback_t _subAckCallback;
+    };
+}
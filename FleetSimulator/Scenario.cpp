@@ -0,0 +1,290 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "Scenario.h"
+
+namespace FleetSimulator
+{
+    namespace
+    {
+        std::string Trim(const std::string& text)
+        {
+            static const char* whitespace = " \t\r\n";
+            auto first = text.find_first_not_of(whitespace);
+            if (first == std::string::npos)
+            {
+                return std::string();
+            }
+            auto last = text.find_last_not_of(whitespace);
+            return text.substr(first, last - first + 1);
+        }
+
+        std::vector<std::string> Split(const std::string& text, char separator)
+        {
+            std::vector<std::string> parts;
+            std::stringstream stream(text);
+            std::string part;
+            while (std::getline(stream, part, separator))
+            {
+                part = Trim(part);
+                if (!part.empty())
+                {
+                    parts.push_back(part);
+                }
+            }
+            return parts;
+        }
+
+        double ParseNumber(const std::string& key, const std::string& value)
+        {
+            try
+            {
+                size_t end = 0;
+                double number = std::stod(value, &end);
+                if (end == value.length() && number >= 0)
+                {
+                    return number;
+                }
+            }
+            catch (const std::exception&)
+            {
+            }
+            throw std::runtime_error("Invalid value for " + key + ": " + value);
+        }
+
+        Scenario::Command& FindOrAddCommand(std::vector<Scenario::Command>& commands, const std::string& name)
+        {
+            for (auto& command : commands)
+            {
+                if (command.name == name)
+                {
+                    return command;
+                }
+            }
+            commands.push_back(Scenario::Command{name, 1, {}});
+            return commands.back();
+        }
+    }
+
+    /*static*/ Scenario Scenario::Load(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open scenario file " + path);
+        }
+
+        Scenario scenario;
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+        {
+            auto comment = line.find('#');
+            if (comment != std::string::npos)
+            {
+                line.erase(comment);
+            }
+            line = Trim(line);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            try
+            {
+                if (line.front() == '[')
+                {
+                    static const std::string phasePrefix = "[phase";
+                    if (line.back() != ']' || line.compare(0, phasePrefix.length(), phasePrefix) != 0)
+                    {
+                        throw std::runtime_error("Expected [phase <name>]");
+                    }
+                    Phase phase;
+                    phase.name = Trim(line.substr(phasePrefix.length(), line.length() - phasePrefix.length() - 1));
+                    if (phase.name.empty())
+                    {
+                        phase.name = "phase" + std::to_string(scenario.phases.size() + 1);
+                    }
+                    scenario.phases.push_back(phase);
+                    continue;
+                }
+
+                auto separator = line.find('=');
+                if (separator == std::string::npos)
+                {
+                    throw std::runtime_error("Expected key = value");
+                }
+                scenario.Set(Trim(line.substr(0, separator)), Trim(line.substr(separator + 1)));
+            }
+            catch (const std::runtime_error& e)
+            {
+                throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": " + e.what());
+            }
+        }
+        return scenario;
+    }
+
+    void Scenario::Set(const std::string& key, const std::string& value)
+    {
+        if (phases.empty())
+        {
+            if (!SetFleetSetting(key, value))
+            {
+                throw std::runtime_error("Unknown setting " + key);
+            }
+        }
+        else
+        {
+            SetPhaseSetting(phases.back(), key, value);
+        }
+    }
+
+    void Scenario::Override(const std::string& key, const std::string& value)
+    {
+        if (SetFleetSetting(key, value))
+        {
+            return;
+        }
+        if (phases.empty())
+        {
+            Phase phase;
+            phase.name = "default";
+            phases.push_back(phase);
+        }
+        for (auto& phase : phases)
+        {
+            SetPhaseSetting(phase, key, value);
+        }
+    }
+
+    /*static*/ void Scenario::SetPhaseSetting(Phase& phase, const std::string& key, const std::string& value)
+    {
+        static const std::string commandPrefix = "command.";
+        static const std::string desiredPrefix = "desired.";
+
+        if (key == "duration_s")
+        {
+            phase.durationS = ParseNumber(key, value);
+        }
+        else if (key == "telemetry_interval_ms")
+        {
+            phase.telemetryIntervalMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "command_rate")
+        {
+            phase.commandRate = ParseNumber(key, value);
+        }
+        else if (key == "command_mix")
+        {
+            for (const auto& entry : Split(value, ','))
+            {
+                auto colon = entry.find(':');
+                auto& command = FindOrAddCommand(phase.commandMix, Trim(entry.substr(0, colon)));
+                command.weight = colon == std::string::npos ? 1 : static_cast<unsigned int>(ParseNumber(key, Trim(entry.substr(colon + 1))));
+            }
+        }
+        else if (key.compare(0, commandPrefix.length(), commandPrefix) == 0)
+        {
+            FindOrAddCommand(phase.commandMix, key.substr(commandPrefix.length())).payloads = Split(value, '|');
+        }
+        else if (key.compare(0, desiredPrefix.length(), desiredPrefix) == 0)
+        {
+            phase.desiredProperties[key.substr(desiredPrefix.length())] = value;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown phase setting " + key);
+        }
+    }
+
+    bool Scenario::SetFleetSetting(const std::string& key, const std::string& value)
+    {
+        if (key == "broker")
+        {
+            auto colon = value.rfind(':');
+            brokerHost = value.substr(0, colon);
+            if (colon != std::string::npos)
+            {
+                brokerPort = static_cast<uint16_t>(ParseNumber(key, value.substr(colon + 1)));
+            }
+        }
+        else if (key == "devices")
+        {
+            deviceCount = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "client_id_prefix")
+        {
+            clientIdPrefix = value;
+        }
+        else if (key == "connect_rate")
+        {
+            connectRate = ParseNumber(key, value);
+        }
+        else if (key == "qos")
+        {
+            qos = static_cast<uint8_t>(ParseNumber(key, value));
+        }
+        else if (key == "telemetry_interval_ms")
+        {
+            telemetryIntervalMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "telemetry_payload_bytes")
+        {
+            telemetryPayloadSize = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "report_interval_s")
+        {
+            reportIntervalS = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "duty_cycle_interval_ms")
+        {
+            dutyCycleIntervalMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "duty_cycle_settle_ms")
+        {
+            dutyCycleSettleMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "duty_cycle_timeout_ms")
+        {
+            dutyCycleTimeoutMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else if (key == "twin_sync_timeout_ms")
+        {
+            twinSyncTimeoutMs = static_cast<unsigned int>(ParseNumber(key, value));
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    void Scenario::Validate() const
+    {
+        if (deviceCount == 0 || connectRate <= 0 || telemetryIntervalMs == 0 || reportIntervalS == 0)
+        {
+            throw std::runtime_error("devices, connect_rate, telemetry_interval_ms and report_interval_s must be positive");
+        }
+        if (qos > 1)
+        {
+            throw std::runtime_error("Only QoS 0 and 1 are supported");
+        }
+        if (dutyCycleIntervalMs > 0 && (qos != 1 || dutyCycleTimeoutMs == 0))
+        {
+            throw std::runtime_error("Duty cycled devices need qos = 1 and a positive duty_cycle_timeout_ms");
+        }
+        if (phases.empty())
+        {
+            throw std::runtime_error("The scenario has no phases");
+        }
+        for (const auto& phase : phases)
+        {
+            for (const auto& command : phase.commandMix)
+            {
+                if (command.payloads.empty())
+                {
+                    throw std::runtime_error("Phase " + phase.name + ": no payload for command " + command.name);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace FleetSimulator
+{
+    // A load test script: fleet wide settings followed by phases that change the telemetry rate and the command mix.
+    //
+    //   broker = 127.0.0.1:1883
+    //   devices = 1000
+    //
+    //   [phase steady]
+    //   duration_s = 60
+    //   telemetry_interval_ms = 1000
+    //   command_rate = 20
+    //   command_mix = light:3, reboot:1
+    //   command.light = {"state":"on"} | {"state":"off"}
+    //   desired.delayBetweenTelemetry = 5
+    struct Scenario
+    {
+        struct Command
+        {
+            std::string name;
+            unsigned int weight = 1;
+            std::vector<std::string> payloads;  // one is picked at random for each command sent
+        };
+
+        struct Phase
+        {
+            std::string name;
+            double durationS = 60;
+            unsigned int telemetryIntervalMs = 0;  // 0 keeps the interval of the previous phase
+            double commandRate = 0;                // commands per second across the fleet
+            std::vector<Command> commandMix;
+            std::map<std::string, std::string> desiredProperties;  // published to every device when the phase starts
+        };
+
+        std::string brokerHost = "127.0.0.1";
+        uint16_t brokerPort = 1883;
+        unsigned int deviceCount = 100;
+        std::string clientIdPrefix = "sim-device-";
+        double connectRate = 200;             // new connections per second during the ramp up
+        uint8_t qos = 1;                      // the device client publishes and subscribes with QoS 1
+        unsigned int telemetryIntervalMs = 5000;
+        unsigned int telemetryPayloadSize = 0;  // pads the telemetry message to this size, 0 for no padding
+        unsigned int reportIntervalS = 5;
+        // Duty cycled devices (CONFIG_IOT_CLIENT_DUTY_CYCLE_MODE): wake up, send the readings queued while sleeping, 
+        // stay for the settle time and until the broker acknowledged them, then sleep for the interval. 0 keeps the devices connected.
+        unsigned int dutyCycleIntervalMs = 0;
+        unsigned int dutyCycleSettleMs = 1000;
+        unsigned int dutyCycleTimeoutMs = 15000;
+        // Like CONFIG_IOT_CLIENT_TWIN_SYNC_TIMEOUT_MS, the devices request their twin document on connect. 0 turns the request off.
+        unsigned int twinSyncTimeoutMs = 10000;
+        std::vector<Phase> phases;
+
+        // Throws std::runtime_error with the file name and line number on a syntax error
+        static Scenario Load(const std::string& path);
+
+        // Applies one key=value line of the file, to the last phase when one was started, otherwise to the fleet settings
+        void Set(const std::string& key, const std::string& value);
+
+        // Applies a command line key=value override, phase settings apply to every phase
+        void Override(const std::string& key, const std::string& value);
+
+        void Validate() const;
+
+    private:
+        bool SetFleetSetting(const std::string& key, const std::string& value);
+        static void SetPhaseSetting(Phase& phase, const std::string& key, const std::string& value);
+    };
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <algorithm>
+#include <cctype>
+#include "VirtualDevice.h"
+
+namespace FleetSimulator
+{
+    namespace
+    {
+        const std::chrono::milliseconds RECONNECT_DELAY(1000);
+        // About what the default RTC telemetry buffer of the device client holds
+        const size_t MAX_QUEUED_TELEMETRY = 32;
+
+        std::string ToLower(std::string_view text)
+        {
+            std::string lower(text);
+            std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c){ return std::tolower(c); });
+            return lower;
+        }
+
+        // The value of a JSON string member, enough for the flat command payloads the sample application expects
+        std::string_view FindJsonString(std::string_view json, std::string_view name)
+        {
+            std::string key = "\"" + std::string(name) + "\"";
+            auto pos = json.find(key);
+            if (pos == std::string_view::npos)
+            {
+                return std::string_view();
+            }
+            pos = json.find(':', pos + key.length());
+            pos = pos == std::string_view::npos ? pos : json.find('"', pos);
+            if (pos == std::string_view::npos)
+            {
+                return std::string_view();
+            }
+            auto end = json.find('"', pos + 1);
+            return end == std::string_view::npos ? std::string_view() : json.substr(pos + 1, end - pos - 1);
+        }
+    }
+
+    VirtualDevice::VirtualDevice(EventLoop& eventLoop, const sockaddr_in& brokerAddress, const Scenario& scenario, unsigned int index, 
+        FleetStats& stats) :
+        _eventLoop(eventLoop), _scenario(scenario), _stats(stats),
+        _connection(eventLoop, brokerAddress, scenario.clientIdPrefix + std::to_string(index)),
+        _topics(_connection.GetClientId()),
+        _dispatcher(_topics, *this, scenario.twinSyncTimeoutMs),
+        _telemetryTopic(_topics.GetTelemetryTopic() + "temperature"),
+        _random(index + 1),
+        _telemetryIntervalMs(scenario.telemetryIntervalMs),
+        _temperature(20.0 + index % 10),
+        _dutyCycleIntervalMs(scenario.dutyCycleIntervalMs)
+    {
+        _connection.SetConnectedCallback([this]() { OnConnected(); });
+        _connection.SetPublishCallback([this](const MqttCodec::Packet& packet) { OnPublish(packet); });
+        _connection.SetClosedCallback([this](const std::string& reason) { OnClosed(reason); });
+        _connection.SetPubAckCallback([this](uint16_t packetId) { OnPubAck(packetId); });
+        _connection.SetSubAckCallback([this](uint16_t) { OnSubAck(); });
+
+        // Like the device client, the broker keeps the session and the commands sent while sleeping
+        _connection.SetCleanSession(!IsDutyCycled());
+    }
+
+    void VirtualDevice::Start()
+    {
+        _isStopped = false;
+        if (IsDutyCycled())
+        {
+            // Spread the wake ups of the fleet over one interval
+            ScheduleWake(std::chrono::milliseconds(_random() % _dutyCycleIntervalMs));
+            return;
+        }
+        _connection.Connect();
+    }
+
+    void VirtualDevice::Stop()
+    {
+        _isStopped = true;
+        _isAwake = false;
+        ++_telemetryGeneration;
+        ++_cycleGeneration;
+        _connection.Disconnect();
+    }
+
+    void VirtualDevice::SetTelemetryInterval(unsigned int intervalMs)
+    {
+        if (intervalMs == 0 || intervalMs == _telemetryIntervalMs)
+        {
+            return;
+        }
+        _telemetryIntervalMs = intervalMs;
+        if (IsConnected() && !IsDutyCycled())
+        {
+            // Spread the first message of the new rate over one interval so the fleet does not publish in lock step
+            RestartTelemetry(std::chrono::milliseconds(_random() % _telemetryIntervalMs));
+        }
+    }
+
+    void VirtualDevice::OnConnected()
+    {
+        ++_stats.GetWindow().connects;
+
+        // The same subscriptions as MqttIoTClient on MQTT_EVENT_CONNECTED, the twin document is requested once they are acknowledged
+        std::vector<std::string> topicFilters = {_topics.GetDesiredPropertyTopic() + "#", _topics.GetCommandsTopic() + "#", 
+            _topics.GetResponsesTopic() + "#"};
+        if (IsTwinSynced())
+        {
+            _dispatcher.BeginTwinSync();
+            topicFilters.push_back(_topics.GetTwinDocumentTopic() + "#");
+        }
+        _connection.Subscribe(topicFilters, _scenario.qos);
+
+        if (!IsDutyCycled())
+        {
+            RestartTelemetry(std::chrono::milliseconds(_random() % _telemetryIntervalMs));
+            return;
+        }
+
+        // RunDutyCycle: flush the queued readings in one burst, then give the broker the settle time to deliver pending messages
+        _unackedTelemetry.clear();
+        for (size_t i = 0; i < _queuedTelemetryCount; ++i)
+        {
+            uint16_t packetId = 0;
+            if (SendTelemetry(&packetId))
+            {
+                _unackedTelemetry.insert(packetId);
+            }
+        }
+
+        uint64_t generation = _cycleGeneration;
+        _eventLoop.ScheduleAfter(std::chrono::milliseconds(_scenario.dutyCycleSettleMs), [this, generation]()
+        {
+            if (generation == _cycleGeneration)
+            {
+                _isSettled = true;
+                CheckCycleCompleted();
+            }
+        });
+    }
+
+    void VirtualDevice::OnSubAck()
+    {
+        if (!_dispatcher.IsTwinSyncPending())
+        {
+            return;
+        }
+
+        _dispatcher.RequestTwinDocument();
+        // The dispatch task of the device checks the timeout on its wake ups
+        _eventLoop.ScheduleAfter(std::chrono::milliseconds(_scenario.twinSyncTimeoutMs + 1), [this]()
+        {
+            if (_dispatcher.CheckTwinSyncTimeout())
+            {
+                ++_stats.GetWindow().twinSyncTimeouts;
+                CheckCycleCompleted();
+            }
+        });
+    }
+
+    void VirtualDevice::OnPubAck(uint16_t packetId)
+    {
+        if (_unackedTelemetry.erase(packetId) > 0 && _queuedTelemetryCount > 0)
+        {
+            --_queuedTelemetryCount;
+            CheckCycleCompleted();
+        }
+    }
+
+    void VirtualDevice::ScheduleWake(std::chrono::milliseconds delay)
+    {
+        uint64_t generation = ++_cycleGeneration;
+        _eventLoop.ScheduleAfter(delay, [this, generation]()
+        {
+            if (generation == _cycleGeneration && !_isStopped)
+            {
+                Wake();
+            }
+        });
+    }
+
+    void VirtualDevice::Wake()
+    {
+        _isAwake = true;
+        _isSettled = false;
+        _wakeTime = Clock::now();
+
+        // The sample application takes a reading per telemetry interval, the device client queues them in RTC memory
+        _queuedTelemetryCount = std::min(MAX_QUEUED_TELEMETRY, _queuedTelemetryCount + std::max(1u, _dutyCycleIntervalMs / _telemetryIntervalMs));
+        _connection.Connect();
+
+        // Like CONFIG_IOT_CLIENT_DUTY_CYCLE_CONNECT_TIMEOUT_MS, the device goes back to sleep when the broker does not answer in time
+        uint64_t generation = _cycleGeneration;
+        _eventLoop.ScheduleAfter(std::chrono::milliseconds(_scenario.dutyCycleTimeoutMs), [this, generation]()
+        {
+            if (generation == _cycleGeneration && _isAwake)
+            {
+                Sleep();
+            }
+        });
+    }
+
+    void VirtualDevice::CheckCycleCompleted()
+    {
+        if (_isAwake && _isSettled && _unackedTelemetry.empty() && !_dispatcher.IsTwinSyncOutstanding())
+        {
+            Sleep();
+        }
+    }
+
+    void VirtualDevice::Sleep()
+    {
+        _isAwake = false;
+        ++_telemetryGeneration;
+        auto& window = _stats.GetWindow();
+        ++window.dutyCycles;
+        window.telemetryKept += _queuedTelemetryCount;
+        window.awakeTime.Add(Clock::now() - _wakeTime);
+
+        _connection.Disconnect();
+        ScheduleWake(std::chrono::milliseconds(_dutyCycleIntervalMs));
+    }
+
+    void VirtualDevice::OnClosed(const std::string& reason)
+    {
+        ++_telemetryGeneration;
+        if (_isStopped || (IsDutyCycled() && !_isAwake))
+        {
+            return;
+        }
+
+        if (IsDutyCycled())
+        {
+            // A dropped connection ends the cycle, the unacknowledged readings stay queued
+            ++_stats.GetWindow().disconnects;
+            Sleep();
+            return;
+        }
+
+        ++_stats.GetWindow().disconnects;
+        if (!reason.empty())
+        {
+            fprintf(stderr, "%s: %s, reconnecting\n", GetClientId().c_str(), reason.c_str());
+        }
+        _eventLoop.ScheduleAfter(RECONNECT_DELAY + std::chrono::milliseconds(_random() % 1000), [this]()
+        {
+            if (!_isStopped)
+            {
+                _connection.Connect();
+            }
+        });
+    }
+
+    void VirtualDevice::OnPublish(const MqttCodec::Packet& packet)
+    {
+        // Our own command responses come back through the responses/# subscription, the device client ignores them as well
+        _dispatcher.Dispatch({packet.topic, packet.payload, packet.packetId, MqttCodec::IsRedelivery(packet), MqttCodec::IsRetained(packet)});
+
+        // A duty cycled device stays awake until its twin document arrived
+        if (IsDutyCycled())
+        {
+            CheckCycleCompleted();
+        }
+    }
+
+    std::string VirtualDevice::ExecuteCommand(std::string_view commandName, std::string_view commandPayload)
+    {
+        std::string result = "{\"result\":\"OK\"}";
+        if (commandPayload.empty() || commandPayload.front() != '{')
+        {
+            result = "{\"result\":\"Error parsing JSON\"}";
+        }
+        else if (ToLower(commandName) == "light")
+        {
+            std::string state = ToLower(FindJsonString(commandPayload, "state"));
+            if (state == "on" || state == "off")
+            {
+                PublishReportedProperty("light", state);
+            }
+            else if (state.empty())
+            {
+                result = "{\"result\":\"Error parsing JSON\"}";
+            }
+        }
+        return result;
+    }
+
+    bool VirtualDevice::PublishResponse(std::string_view commandName, std::string_view response)
+    {
+        return _connection.Publish(_topics.GetResponsesTopic() + std::string(commandName), response, _scenario.qos);
+    }
+
+    bool VirtualDevice::PublishTwinRequest(std::string_view requestId)
+    {
+        return _connection.Publish(_topics.GetTwinGetTopic() + std::string(requestId), std::string_view(), _scenario.qos);
+    }
+
+    void VirtualDevice::OnDesiredPropertiesChanged(const AzureEventGrid::DesiredPropertyList_t& properties)
+    {
+        for (const auto& it : properties)
+        {
+            HandleDesiredProperty(it->first, it->second);
+        }
+    }
+
+    void VirtualDevice::HandleDesiredProperty(std::string_view propertyName, std::string_view propertyValue)
+    {
+        if (propertyName == "delayBetweenTelemetry")
+        {
+            int delayS = atoi(std::string(propertyValue).c_str());
+            if (delayS > 0 && IsDutyCycled())
+            {
+                // CONFIG_IOT_CLIENT_DUTY_CYCLE_INTERVAL_PROPERTY: the property sets the sleep interval, applied from the next cycle
+                _dutyCycleIntervalMs = static_cast<unsigned int>(delayS) * 1000;
+            }
+            else if (delayS > 0)
+            {
+                // The sample application wakes up, sends right away and continues with the new delay
+                _telemetryIntervalMs = static_cast<unsigned int>(delayS) * 1000;
+                RestartTelemetry(std::chrono::milliseconds(0));
+            }
+        }
+    }
+
+    void VirtualDevice::PublishReportedProperty(std::string_view propertyName, std::string_view propertyValue)
+    {
+        _reportedProperties[std::string(propertyName)] = propertyValue;
+        _connection.Publish(_topics.GetReportedPropertyTopic() + std::string(propertyName), propertyValue, _scenario.qos);
+    }
+
+    void VirtualDevice::RestartTelemetry(std::chrono::milliseconds firstDelay)
+    {
+        uint64_t generation = ++_telemetryGeneration;
+        _eventLoop.ScheduleAfter(firstDelay, [this, generation]()
+        {
+            if (generation != _telemetryGeneration || !IsConnected())
+            {
+                return;
+            }
+            SendTelemetry();
+            RestartTelemetry(std::chrono::milliseconds(_telemetryIntervalMs));
+        });
+    }
+
+    bool VirtualDevice::SendTelemetry(uint16_t* pPacketId)
+    {
+        _temperature += (static_cast<int>(_random() % 21) - 10) / 100.0;
+
+        // sentAt lets the cloud probe, running in the same process, measure the end to end latency
+        auto sentAt = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+        char payload[128];
+        int length = snprintf(payload, sizeof(payload), "{\"value\":%.2f,\"seq\":%llu,\"sentAt\":%lld", _temperature,
+            (unsigned long long)++_telemetrySequence, (long long)sentAt);
+
+        std::string message(payload, static_cast<size_t>(length));
+        static const std::string_view paddingKey = ",\"pad\":\"\"}";
+        if (_scenario.telemetryPayloadSize > message.length() + paddingKey.length())
+        {
+            message.append(",\"pad\":\"").append(_scenario.telemetryPayloadSize - message.length() - paddingKey.length(), 'x').append("\"");
+        }
+        message.append("}");
+
+        if (!_connection.Publish(_telemetryTopic, message, _scenario.qos, false, pPacketId))
+        {
+            return false;
+        }
+        ++_stats.GetWindow().telemetrySent;
+        return true;
+    }
+}
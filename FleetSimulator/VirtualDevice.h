@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <random>
+#include <string>
+#include <string_view>
+#include "DeviceTopics.h"
+#include "MessageDispatcher.h"
+#include "EventLoop.h"
+#include "FleetStats.h"
+#include "MqttConnection.h"
+#include "Scenario.h"
+
+namespace FleetSimulator
+{
+    using AzureEventGrid::DeviceTopics;
+
+    // One simulated device: the topic layout and subscriptions of MqttIoTClient with the behaviour of the sample application 
+    // (temperature telemetry, light command, delayBetweenTelemetry). Commands, desired properties and the twin resynchronization
+    // are handled by the MessageDispatcher of the device client, so redeliveries, versioned values and twin documents are handled
+    // by the same code as on the device.
+    class VirtualDevice : private AzureEventGrid::IMessageDispatcherClient
+    {
+    public:
+        VirtualDevice(EventLoop& eventLoop, const sockaddr_in& brokerAddress, const Scenario& scenario, unsigned int index, FleetStats& stats);
+
+        VirtualDevice(const VirtualDevice&) = delete;
+        VirtualDevice& operator=(const VirtualDevice&) = delete;
+
+        void Start();
+        void Stop();
+
+        // Changes the telemetry interval locally, like a new default in the firmware
+        void SetTelemetryInterval(unsigned int intervalMs);
+
+        bool IsConnected() const { return _connection.IsConnected(); }
+        const std::string& GetClientId() const { return _connection.GetClientId(); }
+        const DeviceTopics& GetTopics() const { return _topics; }
+        const MqttConnection& GetConnection() const { return _connection; }
+
+    private:
+        void OnConnected();
+        void OnPublish(const MqttCodec::Packet& packet);
+        void OnClosed(const std::string& reason);
+        void OnPubAck(uint16_t packetId);
+        void OnSubAck();
+
+        // IMessageDispatcherClient
+        std::string ExecuteCommand(std::string_view commandName, std::string_view commandPayload) override;
+        bool PublishResponse(std::string_view commandName, std::string_view response) override;
+        bool PublishTwinRequest(std::string_view requestId) override;
+        void OnDesiredPropertiesChanged(const AzureEventGrid::DesiredPropertyList_t& properties) override;
+
+        void HandleDesiredProperty(std::string_view propertyName, std::string_view propertyValue);
+        void PublishReportedProperty(std::string_view propertyName, std::string_view propertyValue);
+        bool IsTwinSynced() const { return _scenario.twinSyncTimeoutMs > 0; }
+
+        void RestartTelemetry(std::chrono::milliseconds firstDelay);
+        bool SendTelemetry(uint16_t* pPacketId = nullptr);
+
+        // Duty cycled mode, see Scenario::dutyCycleIntervalMs
+        bool IsDutyCycled() const { return _scenario.dutyCycleIntervalMs > 0; }
+        void ScheduleWake(std::chrono::milliseconds delay);
+        void Wake();
+        void Sleep();
+        void CheckCycleCompleted();
+
+        EventLoop& _eventLoop;
+        const Scenario& _scenario;
+        FleetStats& _stats;
+        MqttConnection _connection;
+        const DeviceTopics _topics;
+        AzureEventGrid::MessageDispatcher _dispatcher;
+        std::string _telemetryTopic;
+        std::minstd_rand _random;
+        std::map<std::string, std::string, std::less<>> _reportedProperties;
+        unsigned int _telemetryIntervalMs;
+        uint64_t _telemetrySequence = 0;
+        // Invalidates the telemetry timer when the interval changes or the device disconnects
+        uint64_t _telemetryGeneration = 0;
+        double _temperature;
+        bool _isStopped = false;
+
+        unsigned int _dutyCycleIntervalMs;
+        // Invalidates the wake and timeout timers of a previous cycle
+        uint64_t _cycleGeneration = 0;
+        bool _isAwake = false;
+        bool _isSettled = false;
+        Clock::time_point _wakeTime;
+        // Readings taken while sleeping, they stay queued until the broker acknowledges them
+        size_t _queuedTelemetryCount = 0;
+        std::set<uint16_t> _unackedTelemetry;
+    };
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CloudProbe.h"
+#include "EventLoop.h"
+#include "FleetStats.h"
+#include "Scenario.h"
+#include "VirtualDevice.h"
+
+using namespace FleetSimulator;
+
+namespace
+{
+    volatile sig_atomic_t g_isInterrupted = 0;
+
+    void PrintUsage(const char* program)
+    {
+        printf("Usage: %s [scenario file] [key=value ...]\n"
+            "Runs a fleet of virtual devices against an MQTT broker and reports throughput and end to end latency.\n"
+            "key=value overrides a scenario setting, phase settings apply to every phase (e.g. devices=5000 command_rate=50).\n",
+            program);
+    }
+
+    sockaddr_in ResolveBroker(const Scenario& scenario)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* pResult = nullptr;
+        int error = getaddrinfo(scenario.brokerHost.c_str(), nullptr, &hints, &pResult);
+        if (error != 0 || pResult == nullptr)
+        {
+            throw std::runtime_error("Cannot resolve " + scenario.brokerHost + ": " + gai_strerror(error));
+        }
+
+        sockaddr_in address = *reinterpret_cast<sockaddr_in*>(pResult->ai_addr);
+        address.sin_port = htons(scenario.brokerPort);
+        freeaddrinfo(pResult);
+        return address;
+    }
+
+    // Every device holds a socket, lift the soft limit on open files as far as the hard limit allows
+    void RaiseOpenFileLimit(unsigned int deviceCount)
+    {
+        rlimit limit = {};
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < deviceCount + 64)
+        {
+            fprintf(stderr, "Warning: the open file limit %llu is too low for %u devices\n", (unsigned long long)limit.rlim_cur, deviceCount);
+        }
+    }
+
+    // Schedules the connections of the fleet at the scenario connect rate
+    void ScheduleRampUp(EventLoop& eventLoop, const Scenario& scenario, std::vector<std::unique_ptr<VirtualDevice>>& devices, size_t startedCount)
+    {
+        static const std::chrono::milliseconds tick(10);
+        static double connectCredit = 0;
+
+        connectCredit += scenario.connectRate * std::chrono::duration<double>(tick).count();
+        for (; connectCredit >= 1 && startedCount < devices.size(); connectCredit -= 1)
+        {
+            devices[startedCount++]->Start();
+        }
+
+        if (startedCount < devices.size())
+        {
+            eventLoop.ScheduleAfter(tick, [&eventLoop, &scenario, &devices, startedCount]()
+            {
+                ScheduleRampUp(eventLoop, scenario, devices, startedCount);
+            });
+        }
+    }
+
+    // Connection state and traffic are read from the connections instead of being counted on every packet
+    void SampleFleet(FleetStats& stats, const std::vector<std::unique_ptr<VirtualDevice>>& devices, const CloudProbe& probe)
+    {
+        static uint64_t lastBytesSent = 0;
+        static uint64_t lastBytesReceived = 0;
+
+        size_t connectedDevices = 0;
+        uint64_t bytesSent = probe.GetConnection().GetBytesSent();
+        uint64_t bytesReceived = probe.GetConnection().GetBytesReceived();
+        for (const auto& pDevice : devices)
+        {
+            connectedDevices += pDevice->IsConnected() ? 1 : 0;
+            bytesSent += pDevice->GetConnection().GetBytesSent();
+            bytesReceived += pDevice->GetConnection().GetBytesReceived();
+        }
+
+        FleetCounters& window = stats.GetWindow();
+        window.bytesSent = bytesSent - lastBytesSent;
+        window.bytesReceived = bytesReceived - lastBytesReceived;
+        lastBytesSent = bytesSent;
+        lastBytesReceived = bytesReceived;
+
+        stats.SetConnectedDevices(connectedDevices, devices.size());
+    }
+
+    void ScheduleReports(EventLoop& eventLoop, const Scenario& scenario, FleetStats& stats, const std::vector<std::unique_ptr<VirtualDevice>>& devices,
+        const CloudProbe& probe)
+    {
+        eventLoop.ScheduleAfter(std::chrono::seconds(scenario.reportIntervalS), [&eventLoop, &scenario, &stats, &devices, &probe]()
+        {
+            SampleFleet(stats, devices, probe);
+            stats.ReportWindow();
+            ScheduleReports(eventLoop, scenario, stats, devices, probe);
+        });
+    }
+
+    void ScheduleInterruptCheck(EventLoop& eventLoop)
+    {
+        eventLoop.ScheduleAfter(std::chrono::milliseconds(100), [&eventLoop]()
+        {
+            if (g_isInterrupted)
+            {
+                eventLoop.Stop();
+            }
+            ScheduleInterruptCheck(eventLoop);
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        Scenario scenario;
+        std::vector<std::pair<std::string, std::string>> overrides;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string argument = argv[i];
+            auto separator = argument.find('=');
+            if (argument == "-h" || argument == "--help")
+            {
+                PrintUsage(argv[0]);
+                return 0;
+            }
+            else if (separator != std::string::npos)
+            {
+                overrides.emplace_back(argument.substr(0, separator), argument.substr(separator + 1));
+            }
+            else
+            {
+                scenario = Scenario::Load(argument);
+            }
+        }
+        for (const auto& [key, value] : overrides)
+        {
+            scenario.Override(key, value);
+        }
+        scenario.Validate();
+
+        RaiseOpenFileLimit(scenario.deviceCount);
+        signal(SIGINT, [](int) { g_isInterrupted = 1; });
+        signal(SIGTERM, [](int) { g_isInterrupted = 1; });
+        signal(SIGPIPE, SIG_IGN);
+
+        sockaddr_in brokerAddress = ResolveBroker(scenario);
+        EventLoop eventLoop;
+        FleetStats stats;
+
+        std::vector<std::unique_ptr<VirtualDevice>> devices;
+        devices.reserve(scenario.deviceCount);
+        for (unsigned int i = 0; i < scenario.deviceCount; ++i)
+        {
+            devices.push_back(std::make_unique<VirtualDevice>(eventLoop, brokerAddress, scenario, i, stats));
+        }
+
+        CloudProbe probe(eventLoop, brokerAddress, scenario, stats, devices);
+        probe.Start();
+        ScheduleInterruptCheck(eventLoop);
+
+        // The probe must see the first telemetry message, wait for it before starting the fleet
+        auto probeDeadline = Clock::now() + std::chrono::seconds(5);
+        while (!probe.IsConnected() && Clock::now() < probeDeadline && !g_isInterrupted)
+        {
+            eventLoop.RunUntil(std::min(probeDeadline, Clock::now() + std::chrono::milliseconds(10)));
+        }
+        if (!probe.IsConnected())
+        {
+            throw std::runtime_error("Cannot connect to the broker at " + scenario.brokerHost + ":" + std::to_string(scenario.brokerPort));
+        }
+
+        printf("Simulating %u devices against %s:%u, %zu phases\n", scenario.deviceCount, scenario.brokerHost.c_str(), scenario.brokerPort,
+            scenario.phases.size());
+        ScheduleRampUp(eventLoop, scenario, devices, 0);
+        ScheduleReports(eventLoop, scenario, stats, devices, probe);
+
+        for (const auto& phase : scenario.phases)
+        {
+            if (g_isInterrupted)
+            {
+                break;
+            }
+
+            stats.BeginPhase(phase.name);
+            for (const auto& pDevice : devices)
+            {
+                pDevice->SetTelemetryInterval(phase.telemetryIntervalMs);
+            }
+            probe.BeginPhase(phase);
+
+            eventLoop.RunUntil(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(phase.durationS)));
+            SampleFleet(stats, devices, probe);
+            stats.ReportPhase();
+        }
+
+        for (const auto& pDevice : devices)
+        {
+            pDevice->Stop();
+        }
+        probe.Stop();
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdio.h>
+
+// Minimal checks for the host tests of the device client, a test executable returns the number of failed checks
+namespace HostTest
+{
+    inline int& FailureCount()
+    {
+        static int failureCount = 0;
+        return failureCount;
+    }
+
+    template<typename Test>
+    void Run(const char* name, Test test)
+    {
+        int failuresBefore = FailureCount();
+        test();
+        printf("%s %s\n", FailureCount() == failuresBefore ? "PASS" : "FAIL", name);
+    }
+}
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++HostTest::FailureCount(); \
+        } \
+    } while (0)
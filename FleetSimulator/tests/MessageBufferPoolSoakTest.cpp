@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include "MessageBufferPool.h"
+#include "HostTest.h"
+
+// Long run of the client I/O allocation pattern (topics, payload copies, response envelopes, twin values) on the simulated 
+// internal heap of the shims, while the MQTT/TLS buffer is reallocated at each reconnect. Each run is split into periods,
+// the heap fragmentation and the high water marks at the end of each period must stay flat once the run has warmed up.
+// The same workload first runs with plain heap strings as the baseline the pool fragmentation is compared to.
+//
+// The test links with -Wl,--wrap=malloc -Wl,--wrap=free, so that the heap fallbacks of the pool and the baseline strings
+// allocate from the simulated heap like malloc does on the device. The host C++ runtime keeps its own heap.
+//
+//   message_pool_soak_test [message count]
+
+using AzureEventGrid::MessageBufferPool;
+using AzureEventGrid::PoolString;
+using AzureEventGrid::PoolPropertyMap;
+
+namespace
+{
+    const size_t DEFAULT_MESSAGE_COUNT = 2000000;
+    const int PERIOD_COUNT = 20;
+    // The MQTT and TLS buffer sizes of sdkconfig.ci, reallocated at each reconnect
+    const size_t TLS_BUFFER_SIZE = 16 * 1024;
+    const size_t MESSAGES_PER_RECONNECT = 5000;
+    const size_t MAX_MESSAGES_IN_FLIGHT = 6;
+    const size_t MAX_PAYLOAD_SIZE = 3000;
+    // Fragmentation may vary between periods, but must not trend upwards
+    const unsigned int FRAGMENTATION_TOLERANCE_PERCENT = 5;
+    // Rare bursts of large messages still raise the pool peak by a few blocks over a long run, a leak raises it every period
+    const size_t PEAK_TOLERANCE_BLOCKS = 4;
+    // Payloads larger than a large block fall back to the heap by design, 4% of the workload
+    const unsigned int MAX_FALLBACK_PERCENT = 5;
+
+    // Heap allocations that a pool block could have held, the pool was exhausted
+    size_t g_poolSizedMallocCount = 0;
+
+    struct PeriodStats
+    {
+        size_t freeSize;
+        size_t minimumFreeSize;
+        size_t largestFreeBlock;
+        unsigned int fragmentationPercent;
+        size_t poolPeakInUse;
+        size_t fallbackAllocations;
+        size_t poolSizedFallbacks;
+        size_t failedTlsAllocations;
+    };
+
+    // Allocates from the heap through malloc, what the client did before the pool
+    template<typename T>
+    class HeapAllocator
+    {
+    public:
+        using value_type = T;
+
+        HeapAllocator() noexcept = default;
+        template<typename U>
+        HeapAllocator(const HeapAllocator<U>&) noexcept {}
+
+        T* allocate(size_t count)
+        {
+            void* pBuffer = malloc(count * sizeof(T));
+            if (pBuffer == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(pBuffer);
+        }
+
+        void deallocate(T* pBuffer, size_t)
+        {
+            free(pBuffer);
+        }
+
+        template<typename U>
+        bool operator==(const HeapAllocator<U>&) const noexcept { return true; }
+        template<typename U>
+        bool operator!=(const HeapAllocator<U>&) const noexcept { return false; }
+    };
+
+    using HeapString = std::basic_string<char, std::char_traits<char>, HeapAllocator<char>>;
+    using HeapPropertyMap = std::map<HeapString, HeapString, std::less<HeapString>, HeapAllocator<std::pair<const HeapString, HeapString>>>;
+
+    unsigned int GetFragmentationPercent(size_t freeSize, size_t largestFreeBlock)
+    {
+        return freeSize > 0 ? static_cast<unsigned int>(100 - (largestFreeBlock * 100) / freeSize) : 0;
+    }
+
+    template<typename String, typename PropertyMap>
+    class Workload
+    {
+    public:
+        explicit Workload(uint32_t seed) : _random(seed)
+        {
+            _pTlsBuffer = heap_caps_malloc(TLS_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        }
+
+        ~Workload()
+        {
+            heap_caps_free(_pTlsBuffer);
+        }
+
+        std::vector<PeriodStats> Run(size_t messageCount)
+        {
+            std::vector<PeriodStats> periods;
+            size_t messagesPerPeriod = messageCount / PERIOD_COUNT;
+            for (int period = 0; period < PERIOD_COUNT; ++period)
+            {
+                size_t minimumFreeSize = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+                for (size_t i = 0; i < messagesPerPeriod; ++i)
+                {
+                    HandleMessage();
+                    if (++_messageCount % MESSAGES_PER_RECONNECT == 0)
+                    {
+                        Reconnect();
+                    }
+                    minimumFreeSize = std::min(minimumFreeSize, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+                }
+
+                PeriodStats stats = {};
+                stats.freeSize = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+                stats.minimumFreeSize = minimumFreeSize;
+                stats.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+                stats.fragmentationPercent = GetFragmentationPercent(stats.freeSize, stats.largestFreeBlock);
+                // The baseline must not create the pool region
+                if constexpr (IS_POOLED)
+                {
+                    auto poolStats = MessageBufferPool::GetInstance().GetStats();
+                    for (const auto& sizeClass : poolStats.sizeClasses)
+                    {
+                        stats.poolPeakInUse += sizeClass.peakInUse;
+                    }
+                    stats.fallbackAllocations = poolStats.fallbackAllocations;
+                    stats.poolSizedFallbacks = g_poolSizedMallocCount;
+                }
+                stats.failedTlsAllocations = _failedTlsAllocations;
+                periods.push_back(stats);
+            }
+            return periods;
+        }
+
+    private:
+        static constexpr bool IS_POOLED = std::is_same_v<String, PoolString>;
+
+        struct InboundMessage
+        {
+            String topic;
+            String payload;
+            String response;
+        };
+
+        size_t GetRandomSize(size_t minimum, size_t maximum)
+        {
+            return std::uniform_int_distribution<size_t>(minimum, maximum)(_random);
+        }
+
+        // Mostly small payloads, a few larger than the large blocks
+        size_t GetPayloadSize()
+        {
+            size_t percentile = GetRandomSize(0, 99);
+            return percentile < 70 ? GetRandomSize(8, 200) : percentile < 96 ? GetRandomSize(200, 1000) : GetRandomSize(1000, MAX_PAYLOAD_SIZE);
+        }
+
+        void HandleMessage()
+        {
+            static const char* commandNames[] = { "reboot", "setLed", "getDiagnostics", "runSelfTest" };
+            static const char* propertyNames[] = { "delayBetweenTelemetry", "ledColor", "reportingMode", "thresholds", "schedule", "ota" };
+
+            bool isCommand = GetRandomSize(0, 3) != 0;
+            InboundMessage message;
+            message.topic = "device/soak-device-0042/";
+            message.topic += isCommand ? "commands/" : "twin/desired/";
+            const char* name = isCommand ? commandNames[GetRandomSize(0, 3)] : propertyNames[GetRandomSize(0, 5)];
+            message.topic += name;
+            message.payload.assign(GetPayloadSize(), 'p');
+
+            if (isCommand)
+            {
+                String result(GetRandomSize(2, 400), 'r');
+                message.response = "{\"status\": 200, \"payload\": " + result + "}";
+            }
+            else
+            {
+                _properties[String(name)] = message.payload;
+            }
+
+            // The dispatch queue holds a few messages, they are released out of step with their allocation
+            _messagesInFlight.push_back(std::move(message));
+            while (_messagesInFlight.size() > GetRandomSize(1, MAX_MESSAGES_IN_FLIGHT))
+            {
+                _messagesInFlight.pop_front();
+            }
+        }
+
+        void Reconnect()
+        {
+            heap_caps_free(_pTlsBuffer);
+            _pTlsBuffer = heap_caps_malloc(TLS_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+            if (_pTlsBuffer == nullptr)
+            {
+                ++_failedTlsAllocations;
+            }
+        }
+
+        std::mt19937 _random;
+        std::deque<InboundMessage> _messagesInFlight;
+        PropertyMap _properties;
+        void* _pTlsBuffer = nullptr;
+        size_t _messageCount = 0;
+        size_t _failedTlsAllocations = 0;
+    };
+
+    void PrintPeriods(const std::vector<PeriodStats>& periods)
+    {
+        printf("  period   free  min free  largest block  fragmentation  pool peak  heap fallbacks  pool sized  failed TLS\n");
+        for (size_t i = 0; i < periods.size(); ++i)
+        {
+            const auto& stats = periods[i];
+            printf("  %6u %6u %9u %14u %13u%% %10u %15u %11u %11u\n", (unsigned int)i + 1, (unsigned int)stats.freeSize, 
+                (unsigned int)stats.minimumFreeSize, (unsigned int)stats.largestFreeBlock, stats.fragmentationPercent, 
+                (unsigned int)stats.poolPeakInUse, (unsigned int)stats.fallbackAllocations, (unsigned int)stats.poolSizedFallbacks,
+                (unsigned int)stats.failedTlsAllocations);
+        }
+    }
+
+    // The highest fragmentation once the run has warmed up
+    unsigned int GetSteadyFragmentationPercent(const std::vector<PeriodStats>& periods)
+    {
+        unsigned int fragmentation = 0;
+        for (size_t i = periods.size() / 4; i < periods.size(); ++i)
+        {
+            fragmentation = std::max(fragmentation, periods[i].fragmentationPercent);
+        }
+        return fragmentation;
+    }
+
+    // The first quarter is the warm up, the rest must not trend
+    void CheckFlat(const std::vector<PeriodStats>& periods)
+    {
+        const size_t warmUpCount = periods.size() / 4;
+        const size_t halfCount = periods.size() / 2;
+
+        unsigned int firstHalfFragmentation = 0;
+        unsigned int secondHalfFragmentation = 0;
+        for (size_t i = warmUpCount; i < periods.size(); ++i)
+        {
+            auto& fragmentation = i < halfCount ? firstHalfFragmentation : secondHalfFragmentation;
+            fragmentation = std::max(fragmentation, periods[i].fragmentationPercent);
+        }
+        CHECK(secondHalfFragmentation <= firstHalfFragmentation + FRAGMENTATION_TOLERANCE_PERCENT);
+
+        // The high water marks stop moving once the workload has been seen
+        CHECK(periods.back().poolPeakInUse <= periods[warmUpCount].poolPeakInUse + PEAK_TOLERANCE_BLOCKS);
+        // A burst of large messages occasionally lowers the minimum free heap of one period, a leak lowers all of them
+        size_t firstHalfMinimumFreeSize = 0;
+        size_t secondHalfMinimumFreeSize = 0;
+        for (size_t i = warmUpCount; i < periods.size(); ++i)
+        {
+            auto& minimumFreeSize = i < halfCount ? firstHalfMinimumFreeSize : secondHalfMinimumFreeSize;
+            minimumFreeSize += periods[i].minimumFreeSize;
+        }
+        firstHalfMinimumFreeSize /= halfCount - warmUpCount;
+        secondHalfMinimumFreeSize /= periods.size() - halfCount;
+        CHECK(secondHalfMinimumFreeSize + MAX_PAYLOAD_SIZE >= firstHalfMinimumFreeSize);
+
+        CHECK(periods.back().failedTlsAllocations == 0);
+    }
+
+    // The pool is sized for the workload: once warmed up it is never exhausted, only oversized payloads use the heap
+    void CheckFallbacks(const std::vector<PeriodStats>& periods, size_t messageCount)
+    {
+        const size_t warmUpCount = periods.size() / 4;
+        CHECK(periods.back().poolSizedFallbacks == periods[warmUpCount - 1].poolSizedFallbacks);
+        CHECK(periods.back().fallbackAllocations * 100 <= messageCount * MAX_FALLBACK_PERCENT);
+    }
+}
+
+// The malloc and free calls of the objects in the test, including MessageBufferPool.cpp
+extern "C" void* __wrap_malloc(size_t size)
+{
+    if (size <= CONFIG_IOT_CLIENT_POOL_LARGE_BLOCK_SIZE)
+    {
+        ++g_poolSizedMallocCount;
+    }
+    return heap_caps_malloc_default(size);
+}
+
+extern "C" void __wrap_free(void* ptr)
+{
+    heap_caps_free(ptr);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t messageCount = argc > 1 ? strtoul(argv[1], nullptr, 10) : DEFAULT_MESSAGE_COUNT;
+
+    // The baseline runs before the pool region exists
+    const size_t initialFreeSize = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    unsigned int baselineFragmentation = 0;
+    HostTest::Run("heap only baseline", [&]()
+    {
+        Workload<HeapString, HeapPropertyMap> workload(42);
+        auto periods = workload.Run(messageCount);
+        PrintPeriods(periods);
+        baselineFragmentation = GetSteadyFragmentationPercent(periods);
+    });
+    CHECK(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) == initialFreeSize);
+
+    // The pool region is allocated from the internal heap once
+    MessageBufferPool::GetInstance();
+    const size_t poolFreeSize = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    g_poolSizedMallocCount = 0;
+
+    HostTest::Run("message buffer pool soak", [&]()
+    {
+        Workload<PoolString, PoolPropertyMap> workload(42);
+        auto periods = workload.Run(messageCount);
+        PrintPeriods(periods);
+        CheckFlat(periods);
+        CheckFallbacks(periods, messageCount);
+
+        unsigned int poolFragmentation = GetSteadyFragmentationPercent(periods);
+        printf("Steady state fragmentation: %u%% with the pool, %u%% heap only\n", poolFragmentation, baselineFragmentation);
+        CHECK(poolFragmentation <= baselineFragmentation);
+    });
+
+    // Nothing leaked from the pool or the heap
+    auto stats = MessageBufferPool::GetInstance().GetStats();
+    for (const auto& sizeClass : stats.sizeClasses)
+    {
+        CHECK(sizeClass.inUse == 0);
+    }
+    CHECK(stats.fallbackInUse == 0);
+    CHECK(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) == poolFreeSize);
+    return HostTest::FailureCount();
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "esp_timer.h"
+#include "MessageDispatcher.h"
+#include "HostTest.h"
+
+// The inbound message handling shared by the device client and the fleet simulator (MessageDispatcher.h):
+// command redelivery, versioned and retained desired properties and the twin resynchronization after a connect.
+
+using AzureEventGrid::DesiredPropertyList_t;
+using AzureEventGrid::DeviceTopics;
+using AzureEventGrid::IMessageDispatcherClient;
+using AzureEventGrid::MessageDispatcher;
+
+namespace
+{
+    const uint32_t TWIN_SYNC_TIMEOUT_MS = 50;
+
+    class RecordingClient : public IMessageDispatcherClient
+    {
+    public:
+        std::string ExecuteCommand(std::string_view commandName, std::string_view) override
+        {
+            executedCommands.emplace_back(commandName);
+            return "{\"result\":\"OK\"}";
+        }
+
+        bool PublishResponse(std::string_view commandName, std::string_view response) override
+        {
+            responses.emplace_back(commandName, response);
+            return true;
+        }
+
+        bool PublishTwinRequest(std::string_view requestId) override
+        {
+            twinRequests.emplace_back(requestId);
+            return true;
+        }
+
+        void OnDesiredPropertiesChanged(const DesiredPropertyList_t& properties) override
+        {
+            std::vector<std::pair<std::string, std::string>> notification;
+            for (const auto& it : properties)
+            {
+                notification.emplace_back(it->first, it->second);
+            }
+            notifications.push_back(notification);
+        }
+
+        std::vector<std::string> executedCommands;
+        std::vector<std::pair<std::string, std::string>> responses;
+        std::vector<std::string> twinRequests;
+        std::vector<std::vector<std::pair<std::string, std::string>>> notifications;
+    };
+
+    struct Device
+    {
+        DeviceTopics topics { "test-device" };
+        RecordingClient client;
+        MessageDispatcher dispatcher { topics, client, TWIN_SYNC_TIMEOUT_MS };
+
+        bool Receive(const std::string& topic, std::string_view payload, uint16_t packetId, bool isRedelivery = false, bool isRetained = false)
+        {
+            return dispatcher.Dispatch({topic, payload, packetId, isRedelivery, isRetained});
+        }
+    };
+
+    void TestCommandRedelivery()
+    {
+        Device device;
+        const std::string topic = device.topics.GetCommandsTopic() + "light";
+        CHECK(device.Receive(topic, "{\"state\":\"on\"}", 1));
+        CHECK(device.Receive(topic, "{\"state\":\"on\"}", 1, true));
+        CHECK(device.client.executedCommands.size() == 1);
+        CHECK(device.client.responses.size() == 2);
+        CHECK(device.client.responses[0] == device.client.responses[1]);
+        CHECK(device.client.responses[0].second == "{\"status\": 200, \"payload\": {\"result\":\"OK\"}}");
+
+        // The same command sent again on purpose is executed again
+        CHECK(device.Receive(topic, "{\"state\":\"on\"}", 2));
+        CHECK(device.client.executedCommands.size() == 2);
+        CHECK(!device.Receive(device.topics.GetResponsesTopic() + "light", "{}", 3));
+    }
+
+    void TestStaleDesiredVersion()
+    {
+        Device device;
+        const std::string topic = device.topics.GetDesiredPropertyTopic() + "delayBetweenTelemetry";
+        device.Receive(topic, "{\"$version\": 3, \"value\": 5}", 1);
+        device.Receive(topic, "{\"$version\": 2, \"value\": 9}", 2);
+        CHECK(device.client.notifications.size() == 1);
+        CHECK(device.dispatcher.GetDesiredProperties().begin()->second == "5");
+    }
+
+    void TestTwinSync()
+    {
+        Device device;
+        device.Receive(device.topics.GetDesiredPropertyTopic() + "mode", "eco", 1);
+        device.client.notifications.clear();
+
+        // Connected: the retained properties are held back until the document arrives
+        device.dispatcher.BeginTwinSync();
+        device.Receive(device.topics.GetDesiredPropertyTopic() + "delayBetweenTelemetry", "5", 2, false, true);
+        CHECK(device.client.notifications.empty());
+        device.dispatcher.RequestTwinDocument();
+        CHECK(device.client.twinRequests.size() == 1 && device.client.twinRequests[0] == "1");
+
+        // A document of another request is ignored
+        device.Receive(device.topics.GetTwinDocumentTopic() + "7", "{\"$version\": 4, \"desired\": {}}", 3);
+        CHECK(device.dispatcher.IsTwinSyncOutstanding());
+
+        device.Receive(device.topics.GetTwinDocumentTopic() + "1",
+            "{\"$version\": 4, \"desired\": {\"mode\": \"eco\", \"delayBetweenTelemetry\": 5, \"limits\": {\"min\": 1, \"max\": 2.5}}}", 4);
+        CHECK(!device.dispatcher.IsTwinSyncOutstanding());
+        CHECK(device.client.notifications.size() == 1);
+        // The deferred retained value and the new nested one, the unchanged mode is not notified
+        const auto& notification = device.client.notifications.front();
+        CHECK(notification.size() == 2);
+        CHECK(notification.size() == 2 && notification[0].first == "delayBetweenTelemetry" && notification[0].second == "5");
+        CHECK(notification.size() == 2 && notification[1].first == "limits" && notification[1].second == "{\"min\":1,\"max\":2.5}");
+    }
+
+    void TestTwinSyncTimeout()
+    {
+        Device device;
+        device.dispatcher.BeginTwinSync();
+        device.dispatcher.RequestTwinDocument();
+        device.Receive(device.topics.GetDesiredPropertyTopic() + "delayBetweenTelemetry", "5", 1, false, true);
+        CHECK(!device.dispatcher.CheckTwinSyncTimeout());
+        CHECK(device.client.notifications.empty());
+
+        const int64_t deadline = esp_timer_get_time() + (TWIN_SYNC_TIMEOUT_MS + 10) * 1000;
+        while (esp_timer_get_time() < deadline)
+        {
+        }
+        CHECK(device.dispatcher.CheckTwinSyncTimeout());
+        CHECK(device.client.notifications.size() == 1);
+        CHECK(!device.dispatcher.IsTwinSyncOutstanding());
+
+        // Non retained updates are not deferred
+        device.Receive(device.topics.GetDesiredPropertyTopic() + "delayBetweenTelemetry", "6", 2);
+        CHECK(device.client.notifications.size() == 2);
+    }
+}
+
+int main()
+{
+    HostTest::Run("command redelivery", TestCommandRedelivery);
+    HostTest::Run("stale desired version", TestStaleDesiredVersion);
+    HostTest::Run("twin sync", TestTwinSync);
+    HostTest::Run("twin sync timeout", TestTwinSyncTimeout);
+    return HostTest::FailureCount();
+}
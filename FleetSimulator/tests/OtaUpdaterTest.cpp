@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <mbedtls/sha256.h>
+#include "OtaUpdater.h"
+#include "HostTest.h"
+
+// The OTA chunk pipeline (OtaUpdater.h) against a fake partition: chunk ordering, redelivery, gaps, 
+// SHA-256 verification and the throughput of the pipeline itself (hashing and writing, without flash or network).
+
+using AzureEventGrid::IFirmwareWriter;
+using AzureEventGrid::OtaUpdater;
+using TestClock = std::chrono::steady_clock;
+
+namespace
+{
+    // The default OTA partition size of a 4 MB flash
+    const size_t PARTITION_SIZE = 1536 * 1024;
+    const size_t CHUNK_SIZE = 4096;
+    // esp-mqtt delivers a message larger than its receive buffer in several MQTT_EVENT_DATA fragments
+    const size_t FRAGMENT_SIZE = 1024;
+    // Far above what an MQTT connection over TLS delivers to the device (~100 KB/s), the pipeline must never be the bottleneck
+    const double MIN_THROUGHPUT_MB_PER_S = 20.0;
+
+    class FakePartition : public IFirmwareWriter
+    {
+    public:
+        esp_err_t Begin(size_t imageSize) override
+        {
+            if (!isSignatureVerified)
+            {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            if (imageSize > PARTITION_SIZE)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            content.clear();
+            content.reserve(imageSize);
+            isWriting = true;
+            return ESP_OK;
+        }
+
+        esp_err_t Write(const void* data, size_t length) override
+        {
+            if (!isWriting || content.size() + length > PARTITION_SIZE)
+            {
+                return ESP_ERR_INVALID_STATE;
+            }
+            content.insert(content.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + length);
+            return ESP_OK;
+        }
+
+        esp_err_t Activate() override
+        {
+            isWriting = false;
+            isBootPartition = true;
+            return ESP_OK;
+        }
+
+        void Abort() override
+        {
+            isWriting = false;
+            ++abortCount;
+        }
+
+        const char* GetName() const override
+        {
+            return "fake_ota";
+        }
+
+        std::vector<uint8_t> content;
+        bool isWriting = false;
+        bool isBootPartition = false;
+        // The firmware refuses updates when the bootloader does not verify signed app images
+        bool isSignatureVerified = true;
+        int abortCount = 0;
+    };
+
+    // The OTA updater with its fake partition and the progress reports it sent
+    struct OtaTarget
+    {
+        FakePartition partition;
+        std::vector<std::string> progressReports;
+        OtaUpdater updater { partition, [this](std::string_view progress) { progressReports.emplace_back(progress); } };
+
+        std::string GetLastState() const
+        {
+            return GetField("\"state\":\"", "\"");
+        }
+
+        size_t GetLastOffset() const
+        {
+            return std::stoul(GetField("\"offset\":", ","));
+        }
+
+        std::string GetLastError() const
+        {
+            return GetField("\"error\":\"", "\"");
+        }
+
+    private:
+        std::string GetField(const std::string& prefix, const std::string& terminator) const
+        {
+            if (progressReports.empty())
+            {
+                return std::string();
+            }
+            const std::string& report = progressReports.back();
+            size_t first = report.find(prefix);
+            if (first == std::string::npos)
+            {
+                return std::string();
+            }
+            first += prefix.length();
+            return report.substr(first, report.find(terminator, first) - first);
+        }
+    };
+
+    std::vector<uint8_t> MakeImage(size_t size, uint32_t seed)
+    {
+        std::vector<uint8_t> image(size);
+        std::mt19937 random(seed);
+        for (auto& byte : image)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        return image;
+    }
+
+    std::string GetSha256Hex(const std::vector<uint8_t>& image)
+    {
+        unsigned char digest[32];
+        mbedtls_sha256(image.data(), image.size(), digest, 0);
+        std::string hex;
+        for (unsigned char byte : digest)
+        {
+            char byteText[3];
+            snprintf(byteText, sizeof(byteText), "%02x", byte);
+            hex += byteText;
+        }
+        return hex;
+    }
+
+    void SendBegin(OtaUpdater& updater, size_t imageSize, const std::string& sha256)
+    {
+        std::string begin = "{\"size\": " + std::to_string(imageSize) + ", \"sha256\": \"" + sha256 + "\"}";
+        updater.HandleMessage("begin", begin.data(), begin.length(), 0, begin.length());
+    }
+
+    void SendChunk(OtaUpdater& updater, const std::vector<uint8_t>& image, size_t offset, size_t length, size_t fragmentSize = FRAGMENT_SIZE)
+    {
+        std::string subTopic = "chunk/" + std::to_string(offset);
+        const char* data = reinterpret_cast<const char*>(image.data()) + offset;
+        for (size_t fragmentOffset = 0; fragmentOffset < length; fragmentOffset += fragmentSize)
+        {
+            updater.HandleMessage(subTopic, data + fragmentOffset, std::min(fragmentSize, length - fragmentOffset), fragmentOffset, length);
+        }
+    }
+
+    // Send the chunks from offset to the end of the image, the way the cloud does
+    void SendChunksFrom(OtaUpdater& updater, const std::vector<uint8_t>& image, size_t offset, size_t fragmentSize = FRAGMENT_SIZE)
+    {
+        for (; offset < image.size(); offset += CHUNK_SIZE)
+        {
+            SendChunk(updater, image, offset, std::min(CHUNK_SIZE, image.size() - offset), fragmentSize);
+        }
+    }
+
+    void TestInOrderChunks()
+    {
+        // Not a multiple of the chunk size, the last chunk is short
+        auto image = MakeImage(300 * 1000 + 17, 1);
+        OtaTarget target;
+
+        SendBegin(target.updater, image.size(), GetSha256Hex(image));
+        CHECK(target.GetLastState() == "downloading");
+        CHECK(target.updater.IsInProgress());
+
+        SendChunksFrom(target.updater, image, 0);
+        CHECK(target.GetLastState() == "rebooting");
+        CHECK(target.GetLastOffset() == image.size());
+        CHECK(target.partition.content == image);
+        CHECK(target.partition.isBootPartition);
+        CHECK(!target.updater.IsInProgress());
+        // begin, one report per CONFIG_IOT_CLIENT_OTA_PROGRESS_STEP bytes and the final one
+        CHECK(target.progressReports.size() == 1 + image.size() / 65536 + 1);
+    }
+
+    void TestRedeliveredChunks()
+    {
+        auto image = MakeImage(64 * CHUNK_SIZE, 2);
+        OtaTarget target;
+        SendBegin(target.updater, image.size(), GetSha256Hex(image));
+
+        SendChunk(target.updater, image, 0, CHUNK_SIZE);
+        SendChunk(target.updater, image, CHUNK_SIZE, CHUNK_SIZE);
+        // The broker redelivers both chunks after a reconnect
+        SendChunk(target.updater, image, 0, CHUNK_SIZE);
+        SendChunk(target.updater, image, CHUNK_SIZE, CHUNK_SIZE);
+        CHECK(target.partition.content.size() == 2 * CHUNK_SIZE);
+
+        // A chunk that overlaps the data already written, e.g. the sender resumed from an older progress report
+        size_t overlapOffset = 2 * CHUNK_SIZE - 100;
+        SendChunk(target.updater, image, overlapOffset, CHUNK_SIZE);
+        CHECK(target.partition.content.size() == overlapOffset + CHUNK_SIZE);
+
+        size_t offset = overlapOffset + CHUNK_SIZE;
+        SendChunk(target.updater, image, offset, CHUNK_SIZE);
+        SendChunksFrom(target.updater, image, offset);
+        CHECK(target.GetLastState() == "rebooting");
+        CHECK(target.partition.content == image);
+        CHECK(target.partition.isBootPartition);
+    }
+
+    void TestMissingChunk()
+    {
+        auto image = MakeImage(32 * CHUNK_SIZE, 3);
+        OtaTarget target;
+        SendBegin(target.updater, image.size(), GetSha256Hex(image));
+
+        SendChunk(target.updater, image, 0, CHUNK_SIZE);
+        // The chunk at CHUNK_SIZE was lost: the device asks the sender to restart from there
+        size_t reportCount = target.progressReports.size();
+        SendChunk(target.updater, image, 2 * CHUNK_SIZE, CHUNK_SIZE);
+        CHECK(target.progressReports.size() == reportCount + 1);
+        CHECK(target.GetLastState() == "downloading");
+        CHECK(target.GetLastOffset() == CHUNK_SIZE);
+        CHECK(target.partition.content.size() == CHUNK_SIZE);
+
+        SendChunksFrom(target.updater, image, target.GetLastOffset());
+        CHECK(target.GetLastState() == "rebooting");
+        CHECK(target.partition.content == image);
+    }
+
+    void TestResumeAfterReconnect()
+    {
+        auto image = MakeImage(48 * CHUNK_SIZE, 4);
+        std::string sha256 = GetSha256Hex(image);
+        OtaTarget target;
+        SendBegin(target.updater, image.size(), sha256);
+        for (size_t offset = 0; offset < image.size() / 2; offset += CHUNK_SIZE)
+        {
+            SendChunk(target.updater, image, offset, CHUNK_SIZE);
+        }
+
+        // The same image announced again continues from the written offset
+        SendBegin(target.updater, image.size(), sha256);
+        CHECK(target.GetLastState() == "downloading");
+        CHECK(target.GetLastOffset() == image.size() / 2);
+        CHECK(target.partition.abortCount == 0);
+
+        SendChunksFrom(target.updater, image, target.GetLastOffset());
+        CHECK(target.GetLastState() == "rebooting");
+        CHECK(target.partition.content == image);
+    }
+
+    void TestSha256Mismatch()
+    {
+        auto image = MakeImage(16 * CHUNK_SIZE, 5);
+        auto otherImage = MakeImage(image.size(), 6);
+        OtaTarget target;
+        SendBegin(target.updater, image.size(), GetSha256Hex(otherImage));
+
+        SendChunksFrom(target.updater, image, 0);
+        CHECK(target.GetLastState() == "failed");
+        CHECK(target.GetLastError() == "SHA-256 mismatch");
+        CHECK(!target.partition.isBootPartition);
+        CHECK(target.partition.abortCount == 1);
+        CHECK(!target.updater.IsInProgress());
+
+        // Chunks after the failure are ignored
+        SendChunk(target.updater, image, 0, CHUNK_SIZE);
+        CHECK(target.GetLastState() == "failed");
+    }
+
+    void TestImageLargerThanPartition()
+    {
+        auto image = MakeImage(PARTITION_SIZE + 1, 7);
+        OtaTarget target;
+        SendBegin(target.updater, image.size(), GetSha256Hex(image));
+        CHECK(target.GetLastState() == "failed");
+        CHECK(target.GetLastError() == "Image is larger than the OTA partition");
+        CHECK(!target.updater.IsInProgress());
+    }
+
+    void TestUnsignedImagesRefused()
+    {
+        auto image = MakeImage(4 * CHUNK_SIZE, 9);
+        OtaTarget target;
+        target.partition.isSignatureVerified = false;
+        SendBegin(target.updater, image.size(), GetSha256Hex(image));
+        CHECK(target.GetLastState() == "failed");
+        CHECK(target.GetLastError() == "Signed app verification is not enabled");
+        CHECK(!target.updater.IsInProgress());
+
+        SendChunk(target.updater, image, 0, CHUNK_SIZE);
+        CHECK(target.partition.content.empty());
+    }
+
+    void TestThroughput()
+    {
+        const int downloadCount = 8;
+        auto image = MakeImage(PARTITION_SIZE, 8);
+        std::string sha256 = GetSha256Hex(image);
+
+        double seconds = 0;
+        for (int i = 0; i < downloadCount; ++i)
+        {
+            OtaTarget target;
+            auto startTime = TestClock::now();
+            SendBegin(target.updater, image.size(), sha256);
+            SendChunksFrom(target.updater, image, 0);
+            seconds += std::chrono::duration<double>(TestClock::now() - startTime).count();
+            CHECK(target.GetLastState() == "rebooting");
+        }
+
+        double megabytes = static_cast<double>(image.size()) * downloadCount / (1024 * 1024);
+        double throughput = megabytes / seconds;
+        printf("OTA pipeline: %.1f MB in %.0f ms, %.1f MB/s with %u byte chunks in %u byte fragments\n", megabytes, seconds * 1000, throughput, 
+            (unsigned int)CHUNK_SIZE, (unsigned int)FRAGMENT_SIZE);
+        CHECK(throughput >= MIN_THROUGHPUT_MB_PER_S);
+    }
+}
+
+int main()
+{
+    HostTest::Run("in order chunks", TestInOrderChunks);
+    HostTest::Run("redelivered chunks", TestRedeliveredChunks);
+    HostTest::Run("missing chunk", TestMissingChunk);
+    HostTest::Run("resume after reconnect", TestResumeAfterReconnect);
+    HostTest::Run("SHA-256 mismatch", TestSha256Mismatch);
+    HostTest::Run("image larger than the partition", TestImageLargerThanPartition);
+    HostTest::Run("unsigned images refused", TestUnsignedImagesRefused);
+    HostTest::Run("throughput", TestThroughput);
+    return HostTest::FailureCount();
+}
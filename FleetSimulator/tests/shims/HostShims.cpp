@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+// ESP-IDF functions used by the device client code under test
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    }
+    return "UNKNOWN ERROR";
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart called in a host test\n");
+    abort();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
+{
+    if (create_args == nullptr || out_handle == nullptr)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    static char timers;
+    *out_handle = reinterpret_cast<esp_timer_handle_t>(&timers);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t)
+{
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    static const auto startTime = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+namespace
+{
+    // First fit heap with coalescing over a fixed region. The device heap (TLSF) finds blocks differently,
+    // but fragments the same way when long and short lived allocations of varied sizes are interleaved.
+    class SimulatedHeap
+    {
+    public:
+        SimulatedHeap()
+        {
+            BlockHeader* pFirst = reinterpret_cast<BlockHeader*>(_region);
+            pFirst->size = HOST_HEAP_SIZE - sizeof(BlockHeader);
+            pFirst->isFree = true;
+            _freeSize = pFirst->size;
+        }
+
+        void* Allocate(size_t size)
+        {
+            size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            for (BlockHeader* pBlock = First(); pBlock != nullptr; pBlock = Next(pBlock))
+            {
+                if (!pBlock->isFree || pBlock->size < size)
+                {
+                    continue;
+                }
+                // Split when the rest can hold a block of its own
+                if (pBlock->size >= size + sizeof(BlockHeader) + ALIGNMENT)
+                {
+                    BlockHeader* pRest = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(pBlock + 1) + size);
+                    pRest->size = pBlock->size - size - sizeof(BlockHeader);
+                    pRest->isFree = true;
+                    pBlock->size = size;
+                    _freeSize -= sizeof(BlockHeader);
+                }
+                pBlock->isFree = false;
+                _freeSize -= pBlock->size;
+                return pBlock + 1;
+            }
+            return nullptr;
+        }
+
+        void Free(void* pBuffer)
+        {
+            BlockHeader* pFreed = static_cast<BlockHeader*>(pBuffer) - 1;
+            pFreed->isFree = true;
+            _freeSize += pFreed->size;
+
+            // Merge the runs of free blocks around the freed one
+            for (BlockHeader* pBlock = First(); pBlock != nullptr; pBlock = Next(pBlock))
+            {
+                while (pBlock->isFree && Next(pBlock) != nullptr && Next(pBlock)->isFree)
+                {
+                    pBlock->size += sizeof(BlockHeader) + Next(pBlock)->size;
+                    _freeSize += sizeof(BlockHeader);
+                }
+                if (pBlock > pFreed)
+                {
+                    break;
+                }
+            }
+        }
+
+        bool Contains(const void* pBuffer) const
+        {
+            return pBuffer >= _region && pBuffer < _region + HOST_HEAP_SIZE;
+        }
+
+        size_t GetFreeSize() const
+        {
+            return _freeSize;
+        }
+
+        size_t GetLargestFreeBlock()
+        {
+            size_t largestFreeBlock = 0;
+            for (BlockHeader* pBlock = First(); pBlock != nullptr; pBlock = Next(pBlock))
+            {
+                if (pBlock->isFree && pBlock->size > largestFreeBlock)
+                {
+                    largestFreeBlock = pBlock->size;
+                }
+            }
+            return largestFreeBlock;
+        }
+
+    private:
+        static const size_t ALIGNMENT = 16;
+
+        struct alignas(16) BlockHeader
+        {
+            size_t size;    // usable bytes after the header
+            bool isFree;
+        };
+
+        BlockHeader* First()
+        {
+            return reinterpret_cast<BlockHeader*>(_region);
+        }
+
+        BlockHeader* Next(BlockHeader* pBlock)
+        {
+            uint8_t* pNext = reinterpret_cast<uint8_t*>(pBlock + 1) + pBlock->size;
+            return pNext < _region + HOST_HEAP_SIZE ? reinterpret_cast<BlockHeader*>(pNext) : nullptr;
+        }
+
+        alignas(16) uint8_t _region[HOST_HEAP_SIZE];
+        size_t _freeSize = 0;
+    };
+
+    SimulatedHeap& GetHeap()
+    {
+        static SimulatedHeap heap;
+        return heap;
+    }
+}
+
+void* heap_caps_malloc(size_t size, uint32_t)
+{
+    return GetHeap().Allocate(size);
+}
+
+void* heap_caps_malloc_default(size_t size)
+{
+    return GetHeap().Allocate(size);
+}
+
+void heap_caps_free(void* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    if (!GetHeap().Contains(ptr))
+    {
+        fprintf(stderr, "heap_caps_free of a buffer outside the simulated heap\n");
+        abort();
+    }
+    GetHeap().Free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t)
+{
+    return GetHeap().GetFreeSize();
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t)
+{
+    return GetHeap().GetLargestFreeBlock();
+}
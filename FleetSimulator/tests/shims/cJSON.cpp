@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "cJSON.h"
+
+namespace
+{
+    // Twin documents nest one object per property at most, anything deeper is refused
+    const int MAX_NESTING = 16;
+
+    void SkipWhitespace(const char*& p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        {
+            ++p;
+        }
+    }
+
+    char* ParseString(const char*& p, const char* end)
+    {
+        if (p == end || *p != '"')
+        {
+            return nullptr;
+        }
+        std::string text;
+        for (++p; p < end && *p != '"'; ++p)
+        {
+            if (*p == '\\' && ++p == end)
+            {
+                return nullptr;
+            }
+            text += *p;
+        }
+        if (p == end)
+        {
+            return nullptr;
+        }
+        ++p;
+        return strdup(text.c_str());
+    }
+
+    bool ParseLiteral(const char*& p, const char* end, const char* literal)
+    {
+        size_t length = strlen(literal);
+        if (static_cast<size_t>(end - p) < length || strncmp(p, literal, length) != 0)
+        {
+            return false;
+        }
+        p += length;
+        return true;
+    }
+
+    bool ParseValue(const char*& p, const char* end, cJSON* pItem, int depth);
+
+    // The members of an object or the elements of an array, p is after the opening bracket
+    bool ParseChildren(const char*& p, const char* end, cJSON* pParent, char closing, int depth)
+    {
+        SkipWhitespace(p, end);
+        if (p < end && *p == closing)
+        {
+            ++p;
+            return true;
+        }
+
+        cJSON* pLast = nullptr;
+        while (true)
+        {
+            cJSON* pItem = static_cast<cJSON*>(calloc(1, sizeof(cJSON)));
+            if (pLast == nullptr)
+            {
+                pParent->child = pItem;
+            }
+            else
+            {
+                pLast->next = pItem;
+                pItem->prev = pLast;
+            }
+            pLast = pItem;
+
+            SkipWhitespace(p, end);
+            if (closing == '}')
+            {
+                pItem->string = ParseString(p, end);
+                SkipWhitespace(p, end);
+                if (pItem->string == nullptr || p == end || *p++ != ':')
+                {
+                    return false;
+                }
+                SkipWhitespace(p, end);
+            }
+            if (!ParseValue(p, end, pItem, depth))
+            {
+                return false;
+            }
+            SkipWhitespace(p, end);
+            if (p < end && *p == ',')
+            {
+                ++p;
+                continue;
+            }
+            if (p < end && *p == closing)
+            {
+                ++p;
+                return true;
+            }
+            return false;
+        }
+    }
+
+    bool ParseValue(const char*& p, const char* end, cJSON* pItem, int depth)
+    {
+        if (p == end)
+        {
+            return false;
+        }
+        if (*p == '{' || *p == '[')
+        {
+            if (depth >= MAX_NESTING)
+            {
+                return false;
+            }
+            pItem->type = *p == '{' ? cJSON_Object : cJSON_Array;
+            return ParseChildren(++p, end, pItem, pItem->type == cJSON_Object ? '}' : ']', depth + 1);
+        }
+        if (*p == '"')
+        {
+            pItem->type = cJSON_String;
+            pItem->valuestring = ParseString(p, end);
+            return pItem->valuestring != nullptr;
+        }
+        if (ParseLiteral(p, end, "true"))
+        {
+            pItem->type = cJSON_True;
+            return true;
+        }
+        if (ParseLiteral(p, end, "false"))
+        {
+            pItem->type = cJSON_False;
+            return true;
+        }
+        if (ParseLiteral(p, end, "null"))
+        {
+            pItem->type = cJSON_NULL;
+            return true;
+        }
+
+        std::string number(p, end);
+        char* numberEnd = nullptr;
+        pItem->valuedouble = strtod(number.c_str(), &numberEnd);
+        if (numberEnd == number.c_str())
+        {
+            return false;
+        }
+        pItem->type = cJSON_Number;
+        pItem->valueint = static_cast<int>(pItem->valuedouble);
+        p += numberEnd - number.c_str();
+        return true;
+    }
+
+    void PrintString(const char* text, std::string& out)
+    {
+        out += '"';
+        for (const char* p = text; *p != '\0'; ++p)
+        {
+            if (*p == '"' || *p == '\\')
+            {
+                out += '\\';
+            }
+            out += *p;
+        }
+        out += '"';
+    }
+
+    void PrintValue(const cJSON* item, std::string& out)
+    {
+        switch (item->type)
+        {
+            case cJSON_False: out += "false"; break;
+            case cJSON_True: out += "true"; break;
+            case cJSON_NULL: out += "null"; break;
+            case cJSON_String: PrintString(item->valuestring, out); break;
+            case cJSON_Number:
+            {
+                // Like cJSON: integers without a fraction, the shortest round trip precision otherwise
+                char number[32];
+                if (item->valuedouble == static_cast<double>(item->valueint))
+                {
+                    snprintf(number, sizeof(number), "%d", item->valueint);
+                }
+                else
+                {
+                    snprintf(number, sizeof(number), "%1.15g", item->valuedouble);
+                    if (strtod(number, nullptr) != item->valuedouble)
+                    {
+                        snprintf(number, sizeof(number), "%1.17g", item->valuedouble);
+                    }
+                }
+                out += number;
+                break;
+            }
+            case cJSON_Array:
+            case cJSON_Object:
+            {
+                out += item->type == cJSON_Object ? '{' : '[';
+                for (const cJSON* pChild = item->child; pChild != nullptr; pChild = pChild->next)
+                {
+                    if (pChild != item->child)
+                    {
+                        out += ',';
+                    }
+                    if (item->type == cJSON_Object)
+                    {
+                        PrintString(pChild->string, out);
+                        out += ':';
+                    }
+                    PrintValue(pChild, out);
+                }
+                out += item->type == cJSON_Object ? '}' : ']';
+                break;
+            }
+        }
+    }
+}
+
+cJSON* cJSON_ParseWithLength(const char* value, size_t buffer_length)
+{
+    const char* p = value;
+    const char* end = value + buffer_length;
+    SkipWhitespace(p, end);
+    if (p == end || *p != '{')
+    {
+        return nullptr;
+    }
+
+    cJSON* pObject = static_cast<cJSON*>(calloc(1, sizeof(cJSON)));
+    if (!ParseValue(p, end, pObject, 0))
+    {
+        cJSON_Delete(pObject);
+        return nullptr;
+    }
+    return pObject;
+}
+
+cJSON* cJSON_GetObjectItemCaseSensitive(const cJSON* object, const char* string)
+{
+    if (object == nullptr || string == nullptr)
+    {
+        return nullptr;
+    }
+    for (cJSON* pItem = object->child; pItem != nullptr; pItem = pItem->next)
+    {
+        if (pItem->string != nullptr && strcmp(pItem->string, string) == 0)
+        {
+            return pItem;
+        }
+    }
+    return nullptr;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON* item)
+{
+    return item != nullptr && item->type == cJSON_Number;
+}
+
+cJSON_bool cJSON_IsString(const cJSON* item)
+{
+    return item != nullptr && item->type == cJSON_String;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON* item)
+{
+    return item != nullptr && item->type == cJSON_Object;
+}
+
+char* cJSON_PrintUnformatted(const cJSON* item)
+{
+    if (item == nullptr)
+    {
+        return nullptr;
+    }
+    std::string text;
+    PrintValue(item, text);
+    return strdup(text.c_str());
+}
+
+void cJSON_free(void* object)
+{
+    free(object);
+}
+
+void cJSON_Delete(cJSON* item)
+{
+    while (item != nullptr)
+    {
+        cJSON* pNext = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = pNext;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+// The heap_caps functions allocate from a simulated internal heap of HOST_HEAP_SIZE bytes, so that the tests can measure 
+// its fragmentation and fail allocations like the device does. malloc and new still use the host heap.
+#define HOST_HEAP_SIZE (160 * 1024)
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void* heap_caps_malloc_default(size_t size);
+void heap_caps_free(void* ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
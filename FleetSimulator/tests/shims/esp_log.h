@@ -0,0 +1,11 @@
+#pragma once
+#include <stdio.h>
+#include <inttypes.h>
+
+// Errors and warnings go to stderr, the other levels are compiled out but keep their format checked
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOG_SILENT(tag, format, ...) do { if (0) fprintf(stderr, "%s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_SILENT(tag, format, ##__VA_ARGS__)
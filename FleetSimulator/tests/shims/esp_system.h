@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_err.h"
+
+// Nothing under test is expected to restart, the host shim aborts
+void esp_restart(void);
@@ -0,0 +1,22 @@
+#pragma once
+#include <atomic>
+
+// Critical sections of the device code under test, a spinlock on the host
+struct portMUX_TYPE
+{
+    std::atomic<bool> isLocked { false };
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+inline void portENTER_CRITICAL(portMUX_TYPE* pLock)
+{
+    while (pLock->isLocked.exchange(true, std::memory_order_acquire))
+    {
+    }
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE* pLock)
+{
+    pLock->isLocked.store(false, std::memory_order_release);
+}
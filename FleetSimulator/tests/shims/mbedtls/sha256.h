@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <openssl/evp.h>
+
+// The mbedtls SHA-256 API on top of OpenSSL for the host tests
+typedef struct
+{
+    EVP_MD_CTX* pContext;
+} mbedtls_sha256_context;
+
+inline void mbedtls_sha256_init(mbedtls_sha256_context* ctx)
+{
+    ctx->pContext = EVP_MD_CTX_new();
+}
+
+inline void mbedtls_sha256_free(mbedtls_sha256_context* ctx)
+{
+    EVP_MD_CTX_free(ctx->pContext);
+    ctx->pContext = nullptr;
+}
+
+inline int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224)
+{
+    return EVP_DigestInit_ex(ctx->pContext, is224 ? EVP_sha224() : EVP_sha256(), nullptr) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen)
+{
+    return EVP_DigestUpdate(ctx->pContext, input, ilen) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char* output)
+{
+    return EVP_DigestFinal_ex(ctx->pContext, output, nullptr) == 1 ? 0 : -1;
+}
+
+inline int mbedtls_sha256(const unsigned char* input, size_t ilen, unsigned char* output, int is224)
+{
+    return EVP_Digest(input, ilen, output, nullptr, is224 ? EVP_sha224() : EVP_sha256(), nullptr) == 1 ? 0 : -1;
+}
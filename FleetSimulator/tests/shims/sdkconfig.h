@@ -0,0 +1,14 @@
+#pragma once
+// Host build of the device client code under test, the values are the Kconfig defaults
+
+#define CONFIG_IOT_CLIENT_OTA_PROGRESS_STEP 65536
+
+#define CONFIG_IOT_CLIENT_POOL_SMALL_BLOCK_SIZE 64
+#define CONFIG_IOT_CLIENT_POOL_SMALL_BLOCK_COUNT 24
+#define CONFIG_IOT_CLIENT_POOL_MEDIUM_BLOCK_SIZE 256
+#define CONFIG_IOT_CLIENT_POOL_MEDIUM_BLOCK_COUNT 32
+#define CONFIG_IOT_CLIENT_POOL_LARGE_BLOCK_SIZE 1024
+#define CONFIG_IOT_CLIENT_POOL_LARGE_BLOCK_COUNT 20
+
+#define CONFIG_IOT_CLIENT_DEDUP_CACHE_SIZE 8
+#define CONFIG_IOT_CLIENT_DEDUP_WINDOW_MS 60000
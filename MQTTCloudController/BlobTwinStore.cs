@@ -0,0 +1,77 @@
+using System.Text.Json.Nodes;
+using Azure;
+using Azure.Identity;
+using Azure.Storage.Blobs;
+using Azure.Storage.Blobs.Models;
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Logging;
+
+namespace MQTTCloudController;
+
+// One blob per device in the twins container of the function app storage account, updated with optimistic concurrency
+public class BlobTwinStore : ITwinStore
+{
+    private readonly BlobContainerClient _container;
+    private readonly ILogger<BlobTwinStore> _logger;
+    private bool _isContainerCreated;
+
+    public BlobTwinStore(IConfiguration configuration, ILogger<BlobTwinStore> logger)
+    {
+        _logger = logger;
+        var storageAccountName = configuration["AzureWebJobsStorage:accountName"] ??
+                                 throw new ArgumentException("AzureWebJobsStorage__accountName");
+        _container = new BlobContainerClient(new Uri($"https://{storageAccountName}.blob.core.windows.net/twins"),
+            new DefaultAzureCredential());
+    }
+
+    public async Task<JsonObject> GetDocumentAsync(string deviceName)
+    {
+        var (document, _) = await ReadDocumentAsync(_container.GetBlobClient($"{deviceName}.json"));
+        return document;
+    }
+
+    public async Task<long> SetDesiredPropertyAsync(string deviceName, string propertyName, JsonNode? propertyValue)
+    {
+        if (!_isContainerCreated)
+        {
+            await _container.CreateIfNotExistsAsync();
+            _isContainerCreated = true;
+        }
+
+        var blob = _container.GetBlobClient($"{deviceName}.json");
+        while (true)
+        {
+            var (document, eTag) = await ReadDocumentAsync(blob);
+            var version = document["$version"]!.GetValue<long>() + 1;
+            document["$version"] = version;
+            document["desired"]![propertyName] = propertyValue?.DeepClone();
+
+            var conditions = eTag is null
+                ? new BlobRequestConditions { IfNoneMatch = ETag.All }
+                : new BlobRequestConditions { IfMatch = eTag };
+            try
+            {
+                await blob.UploadAsync(BinaryData.FromString(document.ToJsonString()),
+                    new BlobUploadOptions { Conditions = conditions });
+                return version;
+            }
+            catch (RequestFailedException ex) when (ex.Status is 409 or 412)
+            {
+                _logger.LogInformation("Twin of {deviceName} changed concurrently, retrying", deviceName);
+            }
+        }
+    }
+
+    private static async Task<(JsonObject document, ETag? eTag)> ReadDocumentAsync(BlobClient blob)
+    {
+        try
+        {
+            var content = (await blob.DownloadContentAsync()).Value;
+            return (JsonNode.Parse(content.Content.ToString())!.AsObject(), content.Details.ETag);
+        }
+        catch (RequestFailedException ex) when (ex.Status == 404)
+        {
+            return (new JsonObject { ["$version"] = 0L, ["desired"] = new JsonObject() }, null);
+        }
+    }
+}
@@ -1,14 +1,23 @@
 using System;
+using System.Text.RegularExpressions;
 using System.Threading.Tasks;
 using Azure.Messaging.ServiceBus;
+using Microsoft.AspNetCore.Mvc;
 using Microsoft.Azure.Functions.Worker;
 using Microsoft.Extensions.Logging;
 
 namespace MQTTCloudController
 {
     // ReSharper disable once ClassNeverInstantiated.Global
-    public class DeviceMessagesHandler(ILogger<DeviceMessagesHandler> _logger)
+    // ReSharper disable InconsistentNaming
+    public class DeviceMessagesHandler(ILogger<DeviceMessagesHandler> _logger, IMQTTSender _mqttSender, ITwinStore _twinStore)
     {
+        // Published by the devices after each connection, answered on device/<id>/twin/document/<requestId>
+        private static readonly Regex TwinRequestTopic = new("^device/(?<deviceName>[^/]+)/twin/get/(?<requestId>[^/]+)$");
+
+        // Only guards against a corrupted length, the devices compress payloads of a few KB
+        private const int MaxDecompressedLength = 4 * 1024 * 1024;
+
         [Function(nameof(DeviceMessagesHandler))]
         public async Task Run(
             [ServiceBusTrigger("%ServiceBusMqttMessageQueueName%", Connection = "ServiceBusConnection")]
@@ -25,6 +34,22 @@ namespace MQTTCloudController
             if (!string.IsNullOrEmpty(dataBase64))
             {
                 var data = Convert.FromBase64String(dataBase64);
+
+                // Sent once the device was given the contentEncoding desired property "lzss", see SetContentEncoding
+                if (Lzss.IsCompressed(data))
+                {
+                    try
+                    {
+                        var compressedLength = data.Length;
+                        data = Lzss.Decompress(data, MaxDecompressedLength);
+                        _logger.LogInformation("Decompressed {compressedLength} -> {length} bytes", compressedLength, data.Length);
+                    }
+                    catch (InvalidDataException ex)
+                    {
+                        _logger.LogError(ex, "Invalid compressed payload");
+                    }
+                }
+
                 var dataString = System.Text.Encoding.UTF8.GetString(data);
                 _logger.LogInformation("Message Data: {data}", dataString);
             }
@@ -33,8 +58,45 @@ namespace MQTTCloudController
                 _logger.LogInformation("Message Data: {data}", "No data");
             }
 
+            // The MQTT topic is the subject of the routed event
+            var topic = jsonBody.RootElement.TryGetProperty("subject", out var subject) ? subject.GetString() : null;
+            var twinRequest = TwinRequestTopic.Match(topic ?? "");
+            if (twinRequest.Success)
+            {
+                await SendTwinDocumentAsync(twinRequest.Groups["deviceName"].Value, twinRequest.Groups["requestId"].Value);
+            }
+
             // Complete the message
             await messageActions.CompleteMessageAsync(message);
         }
+
+        // Not retried: the device stops waiting for the document after its timeout and falls back to the incremental updates
+        private async Task SendTwinDocumentAsync(string deviceName, string requestId)
+        {
+            try
+            {
+                var document = await _twinStore.GetDocumentAsync(deviceName);
+                _logger.LogInformation("Sending twin document version {version} to {deviceName}", document["$version"], deviceName);
+
+                var result = await _mqttSender.ConnectAsync();
+                if (result is not OkResult)
+                {
+                    _logger.LogError("Error connecting to the MQTT broker");
+                    return;
+                }
+
+                result = await _mqttSender.PublishAsync($"device/{deviceName}/twin/document/{requestId}", document.ToJsonString());
+                if (result is not OkResult)
+                {
+                    _logger.LogError("Error sending the twin document to {deviceName}", deviceName);
+                }
+
+                await _mqttSender.DisconnectAsync();
+            }
+            catch (Exception ex)
+            {
+                _logger.LogError(ex, "Error answering the twin request of {deviceName}", deviceName);
+            }
+        }
     }
 }
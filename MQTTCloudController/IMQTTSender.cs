@@ -6,5 +6,6 @@ public interface IMQTTSender
 {
     Task<IActionResult> ConnectAsync();
     Task<IActionResult> PublishAsync(string topic, string payload);
+    Task<IActionResult> PublishAsync(string topic, byte[] payload);
     Task DisconnectAsync();
 }
\ No newline at end of file
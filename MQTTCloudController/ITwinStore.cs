@@ -0,0 +1,13 @@
+using System.Text.Json.Nodes;
+
+namespace MQTTCloudController;
+
+// The desired properties of each device, as answered to its twin requests
+public interface ITwinStore
+{
+    // {"$version": <n>, "desired": {...}}, version 0 without properties for a device that has none
+    Task<JsonObject> GetDocumentAsync(string deviceName);
+
+    // Returns the new version of the document
+    Task<long> SetDesiredPropertyAsync(string deviceName, string propertyName, JsonNode? propertyValue);
+}
@@ -0,0 +1,78 @@
+namespace MQTTCloudController;
+
+// Decoder of the device payload compression, the format is described in LzssCodec.h of the device client:
+// the "\0LZ" marker, one byte of window bits << 4 | lookahead bits, the uncompressed length (4 bytes, little endian),
+// then a bit stream, most significant bit first, of literals (1 + 8 bits) and back references
+// (0 + window bits of offset - 1 + lookahead bits of length - MinMatch).
+public static class Lzss
+{
+    private const int HeaderSize = 8;
+    private const int MinMatch = 2;
+
+    public static bool IsCompressed(byte[] payload)
+    {
+        return payload.Length >= HeaderSize && payload[0] == 0 && payload[1] == (byte)'L' && payload[2] == (byte)'Z';
+    }
+
+    // Throws InvalidDataException on a corrupted stream or when the content is larger than maxLength
+    public static byte[] Decompress(byte[] payload, int maxLength)
+    {
+        if (!IsCompressed(payload))
+        {
+            throw new InvalidDataException("Not an LZSS payload");
+        }
+
+        var windowBits = payload[3] >> 4;
+        var lookaheadBits = payload[3] & 0x0F;
+        var length = BitConverter.ToUInt32(payload, 4);
+        if (!BitConverter.IsLittleEndian)
+        {
+            length = System.Buffers.Binary.BinaryPrimitives.ReverseEndianness(length);
+        }
+        if (windowBits == 0 || lookaheadBits == 0 || length > maxLength)
+        {
+            throw new InvalidDataException($"Invalid LZSS header, window {windowBits} bits, lookahead {lookaheadBits} bits, length {length}");
+        }
+
+        var content = new byte[length];
+        var contentLength = 0;
+        var bitPosition = (long)HeaderSize * 8;
+
+        int Read(int bitCount)
+        {
+            var value = 0;
+            for (; bitCount > 0; --bitCount, ++bitPosition)
+            {
+                if (bitPosition >= (long)payload.Length * 8)
+                {
+                    throw new InvalidDataException("Truncated LZSS payload");
+                }
+                value = (value << 1) | ((payload[bitPosition / 8] >> (7 - (int)(bitPosition % 8))) & 1);
+            }
+            return value;
+        }
+
+        while (contentLength < length)
+        {
+            if (Read(1) == 1)
+            {
+                content[contentLength++] = (byte)Read(8);
+                continue;
+            }
+
+            var offset = Read(windowBits) + 1;
+            var count = Read(lookaheadBits) + MinMatch;
+            if (offset > contentLength || contentLength + count > length)
+            {
+                throw new InvalidDataException("Invalid LZSS back reference");
+            }
+
+            // Byte by byte, the reference may overlap the bytes it produces
+            for (var i = 0; i < count; ++i, ++contentLength)
+            {
+                content[contentLength] = content[contentLength - offset];
+            }
+        }
+        return content;
+    }
+}
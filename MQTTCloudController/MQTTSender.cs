@@ -104,13 +104,16 @@ public class MQTTSender : IMQTTSender
         return new OkResult();
     }
 
-    public async Task<IActionResult> PublishAsync(string topic, string payload)
+    public Task<IActionResult> PublishAsync(string topic, string payload)
     {
-        var utf8Payload = Encoding.UTF8.GetBytes(payload);
+        return PublishAsync(topic, Encoding.UTF8.GetBytes(payload));
+    }
 
+    public async Task<IActionResult> PublishAsync(string topic, byte[] payload)
+    {
         var message = new MqttApplicationMessageBuilder()
             .WithTopic(topic)
-            .WithPayload(utf8Payload)
+            .WithPayload(payload)
             .WithQualityOfServiceLevel(MqttQualityOfServiceLevel.AtLeastOnce)
             .Build();
 
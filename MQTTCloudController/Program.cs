@@ -12,6 +12,7 @@ var host = new HostBuilder()
         services.AddApplicationInsightsTelemetryWorkerService();
         services.ConfigureFunctionsApplicationInsights();
         services.AddSingleton<IMQTTSender, MQTTSender>();
+        services.AddSingleton<ITwinStore, BlobTwinStore>();
     })
     .Build();
 
@@ -0,0 +1,109 @@
+using System.Security.Cryptography;
+using System.Text.Json;
+using System.Web.Http;
+using Microsoft.AspNetCore.Http;
+using Microsoft.AspNetCore.Mvc;
+using Microsoft.Azure.Functions.Worker;
+using Microsoft.Azure.WebJobs.Extensions.OpenApi.Core.Attributes;
+using Microsoft.Extensions.Logging;
+using Microsoft.OpenApi.Models;
+
+namespace MQTTCloudController;
+
+// ReSharper disable InconsistentNaming
+// ReSharper disable once ClassNeverInstantiated.Global
+public class SendFirmware(ILogger<SendFirmware> _logger, IMQTTSender _mqttSender)
+{
+    // The device receives chunks in its MQTT buffer in several fragments, keep them small to limit the retransmit cost
+    private const int ChunkSize = 4096;
+
+    [Function("SendFirmware")]
+    [OpenApiOperation(operationId: "SendFirmware", tags: ["Device Management"])]
+    [OpenApiParameter(name: "deviceName", In = ParameterLocation.Path, Required = true, Type = typeof(string),
+        Description = "The name of the device")]
+    [OpenApiParameter(name: "offset", In = ParameterLocation.Query, Required = false, Type = typeof(int),
+        Description = "Resume the update at this offset, the \"offset\" of the \"ota\" reported property of the device")]
+    [OpenApiRequestBody("application/octet-stream", typeof(byte[]),
+        Description = "The signed application image (the .bin file of the build)")]
+    public async Task<IActionResult> RunAsync(
+        [HttpTrigger(AuthorizationLevel.Function, "post", Route = "device/{deviceName}/firmware")]
+        HttpRequest req, string deviceName, [FromQuery] int offset)
+    {
+        try
+        {
+            if (string.IsNullOrEmpty(deviceName))
+            {
+                return new BadRequestObjectResult("Device name is required");
+            }
+
+            using var imageStream = new MemoryStream();
+            await req.Body.CopyToAsync(imageStream);
+            var image = imageStream.ToArray();
+
+            if (image.Length == 0)
+            {
+                return new BadRequestObjectResult("The firmware image is required");
+            }
+
+            if (offset < 0 || offset >= image.Length)
+            {
+                return new BadRequestObjectResult("Offset must be inside the image");
+            }
+
+            // Connect to the MQTT broker
+            var result = await _mqttSender.ConnectAsync();
+
+            if (result is BadRequestResult)
+            {
+                _logger.LogError("Error connecting to the MQTT broker");
+                return result;
+            }
+
+            // The device resumes a download when the begin message announces the image it is already receiving
+            var beginPayload = JsonSerializer.Serialize(new
+            {
+                size = image.Length,
+                sha256 = Convert.ToHexString(SHA256.HashData(image)).ToLowerInvariant()
+            });
+
+            result = await _mqttSender.PublishAsync($"device/{deviceName}/ota/begin", beginPayload);
+            if (result is BadRequestResult)
+            {
+                _logger.LogError("Error sending the OTA begin message to the device");
+                return result;
+            }
+
+            for (var chunkOffset = offset; chunkOffset < image.Length; chunkOffset += ChunkSize)
+            {
+                var chunk = image.AsSpan(chunkOffset, Math.Min(ChunkSize, image.Length - chunkOffset)).ToArray();
+                result = await _mqttSender.PublishAsync($"device/{deviceName}/ota/chunk/{chunkOffset}", chunk);
+                if (result is BadRequestResult)
+                {
+                    _logger.LogError("Error sending the OTA chunk at offset {Offset} to the device", chunkOffset);
+                    return result;
+                }
+            }
+
+            _logger.LogInformation("Sent {Size} bytes of firmware from offset {Offset} to {DeviceName}", image.Length,
+                offset, deviceName);
+
+            // Disconnect the client
+            await _mqttSender.DisconnectAsync();
+
+            return new OkResult();
+        }
+        catch (MQTTnet.Exceptions.MqttCommunicationException ex)
+        {
+            _logger.LogError(ex, "Error communicating with the MQTT broker");
+            return new BadRequestErrorMessageResult(ex.Message);
+        }
+        catch (Exception ex)
+        {
+            _logger.LogError(ex, "Error sending firmware to device");
+            return new ObjectResult(ex.Message)
+            {
+                StatusCode = StatusCodes.Status500InternalServerError
+            };
+        }
+    }
+}
@@ -0,0 +1,52 @@
+using Microsoft.AspNetCore.Http;
+using Microsoft.AspNetCore.Mvc;
+using Microsoft.Azure.Functions.Worker;
+using Microsoft.Azure.WebJobs.Extensions.OpenApi.Core.Attributes;
+using Microsoft.Extensions.Logging;
+using Microsoft.OpenApi.Models;
+
+namespace MQTTCloudController;
+
+// ReSharper disable InconsistentNaming
+// ReSharper disable once ClassNeverInstantiated.Global
+public class SetContentEncoding(ILogger<SetContentEncoding> _logger, IMQTTSender _mqttSender, ITwinStore _twinStore)
+{
+    // "lzss" lets the device compress its large telemetry and reported properties, DeviceMessagesHandler decompresses them
+    private static readonly string[] Encodings = ["lzss", "none"];
+
+    [Function("SetContentEncoding")]
+    [OpenApiOperation(operationId: "SetContentEncoding", tags: ["Device Management"])]
+    [OpenApiParameter(name: "deviceName", In = ParameterLocation.Path, Required = true, Type = typeof(string),
+        Description = "The name of the device")]
+    [OpenApiParameter(name: "encoding", In = ParameterLocation.Query, Required = true, Type = typeof(string),
+        Description = "lzss to accept compressed payloads from the device, none to turn compression off")]
+    public async Task<IActionResult> RunAsync(
+        [HttpTrigger(AuthorizationLevel.Function, "post", Route = "device/{deviceName}/configuration/contentEncoding")]
+        HttpRequest req, string deviceName, [FromQuery] string encoding)
+    {
+        if (!Encodings.Contains(encoding))
+        {
+            return new BadRequestObjectResult($"Encoding must be one of: {string.Join(", ", Encodings)}");
+        }
+
+        // Stored first, a device that is offline gets the value from its twin document when it connects
+        await _twinStore.SetDesiredPropertyAsync(deviceName, "contentEncoding", encoding);
+
+        var result = await _mqttSender.ConnectAsync();
+        if (result is not OkResult)
+        {
+            _logger.LogError("Error connecting to the MQTT broker");
+            return result;
+        }
+
+        result = await _mqttSender.PublishAsync($"device/{deviceName}/twin/desired/contentEncoding", encoding);
+        if (result is not OkResult)
+        {
+            _logger.LogError("Error sending the content encoding to the device");
+            return result;
+        }
+
+        await _mqttSender.DisconnectAsync();
+        return new OkResult();
+    }
+}
@@ -9,7 +9,7 @@ namespace MQTTCloudController
 {
     // ReSharper disable once ClassNeverInstantiated.Global
     // ReSharper disable InconsistentNaming
-    public class SetTelegramInterval(ILogger<SetTelegramInterval> _logger, IMQTTSender _mqttSender)
+    public class SetTelegramInterval(ILogger<SetTelegramInterval> _logger, IMQTTSender _mqttSender, ITwinStore _twinStore)
     {
         [Function("SetTelegramInterval")]
         [OpenApiOperation(operationId: "SetTelegramInterval", tags: ["Device Management"])]
@@ -33,6 +33,9 @@ namespace MQTTCloudController
                 return new BadRequestObjectResult("Interval must be less than 3600 seconds");
             }
 
+            // Stored first, a device that is offline gets the value from its twin document when it connects
+            await _twinStore.SetDesiredPropertyAsync(deviceName, "delayBetweenTelemetry", interval);
+
             // Connect to the MQTT broker
             var result = await _mqttSender.ConnectAsync();
 